@@ -1,138 +1,742 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a set of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
-// 
+//
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
-// * After changing buffer data, call bwrite to flush it to disk.
+// * After changing buffer data, call bwrite to write it to disk
+//     now, or bdwrite to leave it dirty in the cache for the
+//     flusher to write later.
+// * To start reading a block that will be wanted soon,
+//     without waiting for it, call breada.
+// * For a block just allocated, call bnew rather than bread:
+//     it zeroes the buffer instead of reading the old contents.
+//     When a block is freed, call bforget to drop any cached
+//     copy, so that it is not written back.
 // * When done with the buffer, call brelse.
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
-// 
-// The implementation uses three state flags internally:
-// * B_BUSY: the block has been returned from bread
-//     and has not been passed back to brelse.  
+//
+// Each buffer has a sleep-lock, held from bread until brelse,
+// so a process waiting for a busy buffer sleeps rather than
+// rescanning the list.  b->refcnt counts the processes using
+// or waiting for the buffer; only buffers with refcnt 0 may
+// be recycled for another block.
+//
+// Lookups go through a hash table of (dev, blockno) chains.
+// The chains share NBLOCK spin-locks, so cache hits on
+// different blocks proceed in parallel.  A chain's lock
+// protects the chain and the refcnt and identity of the
+// buffers on it.  All buffers are also on one LRU list, used
+// only to choose a buffer to recycle and protected by
+// bcache.lock.  brelse does not move buffers on that list,
+// which would need the global lock; it just marks them used,
+// and the recycler gives marked buffers a second chance.
+//
+// The cache grows into free memory.  binit allocates buffer
+// headers for BCACHEPCT percent of free memory but gives only
+// NBUF of them data.  While there are headers left and memory
+// to spare, a miss that would evict a block instead adds a
+// page's worth of buffers.  When kalloc runs short it calls
+// breclaim, which gives back pages whose buffers are all idle.
+//
+// Dirty buffers stay in the cache.  A kernel thread, bflusher,
+// writes them back in block order every FLUSHTICKS ticks, or
+// sooner when a quarter of the cache is dirty.  The recycler
+// passes over dirty buffers; if all idle ones are dirty, bget
+// writes one itself.  bsync writes back a whole device.
+//
+// Buffers the open log transaction has changed are pinned:
+// they hold an extra reference, so they stay in the cache, and
+// are not dirty, so they stay off the disk until the commit.
+//
+// The implementation uses two state flags internally:
 // * B_VALID: the buffer data has been initialized
 //     with the associated disk block contents.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
+// * B_LOGGED: pinned by the log; bdwrite leaves it alone.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+#include "fs.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "buf.h"
 
+#define BPP     (PAGE/BSIZE)  // Buffers per page of data
+#define NBLOCK  64            // Locks shared by the hash chains
+#define NFLUSH  64            // Buffers written per flusher batch
+#define FLUSHTICKS 300        // Write back dirty buffers this often
+
+struct bstat {
+  uint hit;
+  uint miss;
+  uint evict;   // Misses that recycled a cached block
+  uint ra;      // Blocks read ahead
+} __attribute__((aligned(64)));
+
 struct {
-  struct spinlock lock;
-  struct buf buf[NBUF];
+  struct spinlock lock;   // Protects the LRU list and nbuf;
+                          // serializes recycling, growth and reclaim
+  struct buf *buf;        // nbufmax headers, in groups of BPP per page
+  int nbufmax;
+  int nbuf;               // Buffers with data
+  int nfresh;             // Buffers with data never used for a block
+  int reserve;            // Free pages the cache will not grow into
+  volatile uint ndirty;   // Buffers written with bdwrite, not yet on disk
+  struct buf **hash;      // nhash chains through buf.hnext
+  uint nhash;
+  struct spinlock hashlock[NBLOCK];
 
-  // Linked list of all buffers, through prev/next.
+  // Linked list of all buffers with data, through prev/next.
   // head.next is most recently used.
   struct buf head;
+
+  uint ngrow;             // Pages added
+  uint nreclaim;          // Pages given back
+  struct bstat stat[NCPU];
 } bcache;
 
+static int breclaim(int);
+static void bflushbuf(struct buf*);
+static void bput(struct buf*, int);
+
+static uint
+bhash(uint dev, uint blockno)
+{
+  return (dev * 7 + blockno) % bcache.nhash;
+}
+
+static struct spinlock*
+chainlock(uint h)
+{
+  return &bcache.hashlock[h % NBLOCK];
+}
+
+// Give data from a fresh page to the next BPP buffer headers
+// and add them to the cache.  Returns 0 if the cache may not
+// grow.  Called without locks held: kalloc may call breclaim.
+static int
+bgrow(void)
+{
+  struct buf *b, *end;
+  char *p;
+  uint h;
+
+  if(bcache.nbuf >= bcache.nbufmax || kfreecount() <= bcache.reserve)
+    return 0;
+  if((p = kalloc(PAGE)) == 0)
+    return 0;
+
+  acquire(&bcache.lock);
+  for(b = bcache.buf; b < bcache.buf+bcache.nbufmax; b += BPP)
+    if(b->data == 0)
+      break;
+  if(b == bcache.buf+bcache.nbufmax){
+    // Another process got the last headers.
+    release(&bcache.lock);
+    kfree(p, PAGE);
+    return 0;
+  }
+  for(end = b + BPP; b < end; b++, p += BSIZE){
+    // Give each fresh buffer a made-up identity of its own,
+    // to keep them from piling up on one chain.
+    b->data = (uchar*)p;
+    b->dev = -1;
+    b->blockno = b - bcache.buf;
+    b->flags = 0;
+    b->refcnt = 0;
+    b->used = 0;
+    h = bhash(b->dev, b->blockno);
+    acquire(chainlock(h));
+    b->hnext = bcache.hash[h];
+    bcache.hash[h] = b;
+    release(chainlock(h));
+
+    // Put it at the LRU end, to be used first.
+    b->next = &bcache.head;
+    b->prev = bcache.head.prev;
+    bcache.head.prev->next = b;
+    bcache.head.prev = b;
+  }
+  bcache.nbuf += BPP;
+  bcache.nfresh += BPP;
+  bcache.ngrow++;
+  release(&bcache.lock);
+  return 1;
+}
+
 void
 binit(void)
 {
   struct buf *b;
+  int i, n;
 
   initlock(&bcache.lock, "bcache");
-
-  // Create linked list of buffers
+  for(i = 0; i < NBLOCK; i++)
+    initlock(&bcache.hashlock[i], "bcache.bucket");
   bcache.head.prev = &bcache.head;
   bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    b->dev = -1;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+
+  // Headers for as many buffers as BCACHEPCT percent of
+  // free memory can hold, counting the headers themselves.
+  n = kfreecount() / 100 * BCACHEPCT * PAGE / (BSIZE + sizeof(struct buf));
+  n -= n % BPP;
+  if(n < NBUF)
+    n = (NBUF + BPP - 1) / BPP * BPP;
+  bcache.nbufmax = n;
+  bcache.buf = (struct buf*)kalloc((n * sizeof(struct buf) + PAGE - 1) / PAGE * PAGE);
+  bcache.nhash = n / 2 + 1;
+  bcache.hash = (struct buf**)kalloc((bcache.nhash * sizeof(struct buf*) + PAGE - 1) / PAGE * PAGE);
+  if(bcache.buf == 0 || bcache.hash == 0)
+    panic("binit");
+  memset(bcache.buf, 0, n * sizeof(struct buf));
+  memset(bcache.hash, 0, bcache.nhash * sizeof(struct buf*));
+  for(b = bcache.buf; b < bcache.buf+n; b++)
+    initsleeplock(&b->lock, "buffer");
+
+  // Leave the last sixteenth of memory to processes.
+  bcache.reserve = kfreecount() / 16;
+  while(bcache.nbuf < NBUF)
+    if(!bgrow())
+      panic("binit: no memory");
+  kreclaimer(breclaim);
+}
+
+// Order buffers by device, then block number.
+static int
+bblockcmp(struct buf *a, struct buf *b)
+{
+  if(a->dev != b->dev)
+    return a->dev < b->dev ? -1 : 1;
+  if(a->blockno != b->blockno)
+    return a->blockno < b->blockno ? -1 : 1;
+  return 0;
+}
+
+// Look for block blockno on device dev in chain h and take a
+// reference to it.  Caller holds chainlock(h).
+static struct buf*
+bfind(uint h, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bcache.hash[h]; b != 0; b = b->hnext){
+    if(b->dev == dev && b->blockno == blockno){
+      b->refcnt++;
+      bcache.stat[cpu->id].hit++;
+      return b;
+    }
   }
+  return 0;
 }
 
-// Look through buffer cache for sector on device dev.
+// Take b off its hash chain.  Caller holds the chain's lock.
+static void
+bunhash(struct buf *b)
+{
+  struct buf **pp;
+
+  for(pp = &bcache.hash[bhash(b->dev, b->blockno)]; *pp != b; pp = &(*pp)->hnext)
+    ;
+  *pp = b->hnext;
+}
+
+// Move b to the head of the LRU list.  Caller holds bcache.lock.
+static void
+bmru(struct buf *b)
+{
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+  b->next = bcache.head.next;
+  b->prev = &bcache.head;
+  bcache.head.next->prev = b;
+  bcache.head.next = b;
+}
+
+// Recycle the least recently used idle, clean buffer for
+// block blockno on device dev, moving it to chain h.  If every idle
+// buffer is dirty, return 0 and set *victim to the least
+// recently used one, with a reference for the caller to
+// write it back.
+// Caller holds bcache.lock and chainlock(h).
+static struct buf*
+brecycle(uint h, uint dev, uint blockno, struct buf **victim)
+{
+  struct buf *b, *prev, *dirty;
+  struct spinlock *lk;
+  int n;
+
+  dirty = 0;
+  b = bcache.head.prev;
+  for(n = 0; n < 2*bcache.nbuf; b = prev){
+    prev = b->prev;
+    if(b == &bcache.head)
+      continue;
+    n++;
+    if(b->used){
+      // Used since we last looked: second chance.
+      b->used = 0;
+      bmru(b);
+      continue;
+    }
+    lk = chainlock(bhash(b->dev, b->blockno));
+    if(lk != chainlock(h))
+      acquire(lk);
+    if(b->refcnt == 0 && (b->flags & B_DIRTY)){
+      if(dirty == 0)
+        dirty = b;
+    } else if(b->refcnt == 0){
+      bunhash(b);
+      if(lk != chainlock(h))
+        release(lk);
+      if(b->dev == -1)
+        bcache.nfresh--;
+      else
+        bcache.stat[cpu->id].evict++;
+      bcache.stat[cpu->id].miss++;
+      b->dev = dev;
+      b->blockno = blockno;
+      b->flags = 0;
+      b->refcnt = 1;
+      b->hnext = bcache.hash[h];
+      bcache.hash[h] = b;
+      return b;
+    }
+    if(lk != chainlock(h))
+      release(lk);
+  }
+  if(dirty == 0)
+    panic("bget: no buffers");
+  lk = chainlock(bhash(dirty->dev, dirty->blockno));
+  if(lk != chainlock(h))
+    acquire(lk);
+  dirty->refcnt++;
+  if(lk != chainlock(h))
+    release(lk);
+  *victim = dirty;
+  return 0;
+}
+
+// Look through buffer cache for block blockno on device dev.
 // If not found, allocate fresh block.
 // In either case, return locked buffer.
 static struct buf*
-bget(uint dev, uint sector)
+bget(uint dev, uint blockno)
 {
-  struct buf *b;
+  struct buf *b, *victim;
+  uint h;
 
-  acquire(&bcache.lock);
+  h = bhash(dev, blockno);
 
- loop:
+again:
   // Try for cached block.
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->sector == sector){
-      if(!(b->flags & B_BUSY)){
-        b->flags |= B_BUSY;
-        release(&bcache.lock);
-        return b;
-      }
-      sleep(b, &bcache.lock);
-      goto loop;
-    }
+  acquire(chainlock(h));
+  b = bfind(h, dev, blockno);
+  release(chainlock(h));
+  if(b != 0){
+    acquiresleep(&b->lock);
+    return b;
   }
 
-  // Allocate fresh block.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if((b->flags & B_BUSY) == 0){
-      b->dev = dev;
-      b->sector = sector;
-      b->flags = B_BUSY;
-      release(&bcache.lock);
-      return b;
+  // Rather than evict a block, grow the cache if it may.
+  if(bcache.nfresh == 0)
+    bgrow();
+
+  // Allocate fresh block.  Only one process at a time
+  // recycles, so holding a second chain lock while
+  // taking the victim off its chain cannot deadlock.
+  // Look again once the chain is locked: another process
+  // may have read the block meanwhile.
+  acquire(&bcache.lock);
+  acquire(chainlock(h));
+  if((b = bfind(h, dev, blockno)) == 0)
+    b = brecycle(h, dev, blockno, &victim);
+  release(chainlock(h));
+  release(&bcache.lock);
+  if(b == 0){
+    // Only dirty buffers to recycle: clean one and retry.
+    acquiresleep(&victim->lock);
+    bflushbuf(victim);
+    bput(victim, 0);
+    goto again;
+  }
+  acquiresleep(&b->lock);
+  return b;
+}
+
+// Give back up to npages pages of buffers, keeping at least
+// NBUF buffers.  A page can go only if all its buffers are
+// idle and clean; on the first pass, only if none of them
+// has been used lately either.  Called by kalloc when memory
+// is short, so must not sleep.  Returns pages freed.
+static int
+breclaim(int npages)
+{
+  struct buf *b, *b0;
+  struct spinlock *lk;
+  int n, pass, ok;
+  char *p;
+
+  n = 0;
+  acquire(&bcache.lock);
+  for(pass = 0; pass < 2; pass++){
+    for(b0 = bcache.buf; b0 < bcache.buf+bcache.nbufmax; b0 += BPP){
+      if(n >= npages || bcache.nbuf - BPP < NBUF)
+        goto out;
+      if(b0->data == 0)
+        continue;
+
+      // Lock the chains of all the page's buffers so that no
+      // lookup can take a reference meanwhile.  Holding
+      // bcache.lock makes taking several chain locks safe.
+      ok = 1;
+      for(b = b0; b < b0+BPP; b++){
+        lk = chainlock(bhash(b->dev, b->blockno));
+        if(!holding(lk))
+          acquire(lk);
+        if(b->refcnt != 0 || (b->flags & B_DIRTY) || (pass == 0 && b->used))
+          ok = 0;
+      }
+      if(ok){
+        for(b = b0; b < b0+BPP; b++){
+          bunhash(b);
+          b->next->prev = b->prev;
+          b->prev->next = b->next;
+          if(b->dev == -1)
+            bcache.nfresh--;
+        }
+      }
+      for(b = b0; b < b0+BPP; b++){
+        lk = chainlock(bhash(b->dev, b->blockno));
+        if(holding(lk))
+          release(lk);
+      }
+      if(ok){
+        p = (char*)b0->data;
+        for(b = b0; b < b0+BPP; b++)
+          b->data = 0;
+        kfree(p, PAGE);
+        bcache.nbuf -= BPP;
+        bcache.nreclaim++;
+        n++;
+      }
     }
   }
-  panic("bget: no buffers");
+out:
+  release(&bcache.lock);
+  return n;
 }
 
-// Return a B_BUSY buf with the contents of the indicated disk sector.
+// Return a locked buf with the contents of the indicated disk block.
 struct buf*
-bread(uint dev, uint sector)
+bread(uint dev, uint blockno)
 {
   struct buf *b;
 
-  b = bget(dev, sector);
+  b = bget(dev, blockno);
   if(!(b->flags & B_VALID))
     iderw(b);
   return b;
 }
 
+// Return a locked buf for block blockno on device dev, which
+// has just been allocated: zeroed and dirty, without reading
+// the disk.
+struct buf*
+bnew(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  memset(b->data, 0, BSIZE);
+  b->flags |= B_VALID;
+  bdwrite(b);
+  return b;
+}
+
+// Block blockno on device dev has been freed: if it is cached,
+// forget its contents, writing nothing back.
+void
+bforget(uint dev, uint blockno)
+{
+  struct buf *b;
+  uint h;
+
+  h = bhash(dev, blockno);
+  acquire(chainlock(h));
+  for(b = bcache.hash[h]; b != 0; b = b->hnext)
+    if(b->dev == dev && b->blockno == blockno)
+      break;
+  if(b != 0)
+    b->refcnt++;
+  release(chainlock(h));
+  if(b == 0)
+    return;
+
+  acquiresleep(&b->lock);
+  if(b->flags & B_DIRTY)
+    xaddl(&bcache.ndirty, -1);
+  b->flags &= ~(B_VALID|B_DIRTY);
+  bput(b, 0);
+}
+
+// Mark b's contents as needing to be written to disk,
+// but leave the writing to the flusher.  Must be locked.
+// A logged buffer is left for the commit to write.
+void
+bdwrite(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bdwrite");
+  if(b->flags & B_LOGGED)
+    return;
+  if(!(b->flags & B_DIRTY)){
+    b->flags |= B_DIRTY;
+    xaddl(&bcache.ndirty, 1);
+  }
+}
+
+// The open transaction has changed b: keep it in the cache
+// and off the disk until bunpin.  Must be locked.
+void
+bpin(struct buf *b)
+{
+  struct spinlock *lk;
+
+  if(!holdingsleep(&b->lock))
+    panic("bpin");
+  if(b->flags & B_DIRTY){
+    b->flags &= ~B_DIRTY;
+    xaddl(&bcache.ndirty, -1);
+  }
+  b->flags |= B_LOGGED;
+  lk = chainlock(bhash(b->dev, b->blockno));
+  acquire(lk);
+  b->refcnt++;
+  release(lk);
+}
+
+// b's transaction has committed: leave writing b to its
+// home location to the flusher.  Must be locked.
+void
+bunpin(struct buf *b)
+{
+  struct spinlock *lk;
+
+  if(!holdingsleep(&b->lock) || !(b->flags & B_LOGGED))
+    panic("bunpin");
+  b->flags &= ~B_LOGGED;
+  if(b->flags & B_VALID)
+    bdwrite(b);
+  lk = chainlock(bhash(b->dev, b->blockno));
+  acquire(lk);
+  b->refcnt--;
+  release(lk);
+}
+
+// Write b to disk if it is dirty.  Must be locked.
+static void
+bflushbuf(struct buf *b)
+{
+  if(b->flags & B_DIRTY){
+    iderw(b);
+    xaddl(&bcache.ndirty, -1);
+  }
+}
+
+// Start reading block blockno on device dev into the cache, unless
+// it is cached or on its way already.  Does not wait for the
+// disk: the buffer stays locked until ideintr calls biodone.
+void
+breada(uint dev, uint blockno)
+{
+  struct buf *b;
+  uint h;
+
+  h = bhash(dev, blockno);
+  acquire(chainlock(h));
+  for(b = bcache.hash[h]; b != 0; b = b->hnext)
+    if(b->dev == dev && b->blockno == blockno)
+      break;
+  release(chainlock(h));
+  if(b != 0)
+    return;
+
+  b = bget(dev, blockno);
+  if(b->flags & B_VALID){
+    brelse(b);
+    return;
+  }
+  pushcli();
+  bcache.stat[cpu->id].ra++;
+  popcli();
+  b->used = 1;  // Keep it until it has been read.
+  b->flags |= B_ASYNC;
+  iderw(b);
+}
+
+// Called by ideintr when an asynchronous request for b is done.
+void
+biodone(struct buf *b)
+{
+  b->flags &= ~B_ASYNC;
+  bput(b, 0);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
 {
-  if((b->flags & B_BUSY) == 0)
-    panic("bwrite");
-  b->flags |= B_DIRTY;
-  iderw(b);
+  bdwrite(b);
+  bflushbuf(b);
+}
+
+// Unlock b and drop a reference.  If used, mark it
+// used so that it is not recycled soon.
+static void
+bput(struct buf *b, int used)
+{
+  struct spinlock *lk;
+
+  releasesleep(&b->lock);
+
+  lk = chainlock(bhash(b->dev, b->blockno));
+  acquire(lk);
+  b->refcnt--;
+  if(b->refcnt == 0 && used)
+    b->used = 1;
+  release(lk);
 }
 
-// Release the buffer b.
+// Release a locked buffer.
+// Mark it used so that it is not recycled soon.
 void
 brelse(struct buf *b)
 {
-  if((b->flags & B_BUSY) == 0)
+  if(!holdingsleep(&b->lock))
     panic("brelse");
+  bput(b, 1);
+}
 
+// Write back a batch of dirty buffers on dev (or on every
+// device, if dev is -1): the NFLUSH with the lowest block numbers,
+// in block order.  The writes are all queued before any is
+// waited for, so that the disk driver can merge them.
+// Returns the number of buffers in the batch.
+static int
+bflushsome(uint dev)
+{
+  struct buf *b, *batch[NFLUSH];
+  struct spinlock *lk;
+  int i, n;
+
+  // Choose the batch.  Holding bcache.lock keeps identities
+  // fixed until the references are taken.  Flags may change
+  // meanwhile; buffers that turn out to be clean are skipped.
+  n = 0;
   acquire(&bcache.lock);
+  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+    if(!(b->flags & B_DIRTY) || (dev != -1 && b->dev != dev))
+      continue;
+    if(n == NFLUSH && bblockcmp(b, batch[n-1]) >= 0)
+      continue;
+    if(n < NFLUSH)
+      n++;
+    for(i = n-1; i > 0 && bblockcmp(b, batch[i-1]) < 0; i--)
+      batch[i] = batch[i-1];
+    batch[i] = b;
+  }
+  // Two references each: one for biodone to drop,
+  // one to wait for the write with.
+  for(i = 0; i < n; i++){
+    lk = chainlock(bhash(batch[i]->dev, batch[i]->blockno));
+    acquire(lk);
+    batch[i]->refcnt += 2;
+    release(lk);
+  }
+  release(&bcache.lock);
 
-  b->next->prev = b->prev;
-  b->prev->next = b->next;
-  b->next = bcache.head.next;
-  b->prev = &bcache.head;
-  bcache.head.next->prev = b;
-  bcache.head.next = b;
+  for(i = 0; i < n; i++){
+    b = batch[i];
+    acquiresleep(&b->lock);
+    if(b->flags & B_DIRTY){
+      b->flags |= B_ASYNC;
+      iderw(b);
+      xaddl(&bcache.ndirty, -1);
+    } else
+      bput(b, 0);
+  }
+  for(i = 0; i < n; i++){
+    acquiresleep(&batch[i]->lock);
+    bput(batch[i], 0);
+  }
+  return n;
+}
 
-  b->flags &= ~B_BUSY;
-  wakeup(b);
+// Write all dirty buffers on dev to disk.
+void
+bsync(uint dev)
+{
+  int pass;
 
-  release(&bcache.lock);
+  // Bound the passes in case others keep dirtying buffers.
+  for(pass = 0; pass <= bcache.nbuf / NFLUSH; pass++)
+    if(bflushsome(dev) < NFLUSH)
+      break;
 }
 
+// The flusher kernel thread.  Every FLUSHTICKS ticks, or
+// whenever a quarter of the cache is dirty, flushes the dirty
+// inodes into the log, commits it, and writes back all dirty
+// buffers, including the blocks of earlier commits.
+void
+bflusher(void)
+{
+  int t0;
+
+  acquire(&tickslock);
+  t0 = ticks;
+  for(;;){
+    sleep(&ticks, &tickslock);
+    if(ticks - t0 < FLUSHTICKS && bcache.ndirty < bcache.nbuf / 4)
+      continue;
+    t0 = ticks;
+    release(&tickslock);
+    isync();
+    logsync();
+    bsync(-1);
+    acquire(&tickslock);
+  }
+}
+
+// Print buffer cache statistics.  Runs when user
+// types ^B on console.  No locks, to avoid wedging
+// a stuck machine further.
+void
+bcachedump(void)
+{
+  struct bstat *s;
+  uint hit, miss, evict, ra;
+
+  hit = miss = evict = ra = 0;
+  for(s = bcache.stat; s < bcache.stat+NCPU; s++){
+    hit += s->hit;
+    miss += s->miss;
+    evict += s->evict;
+    ra += s->ra;
+  }
+  cprintf("bcache: %d of %d buffers, %d dirty, %d hits, %d misses, %d evictions\n",
+          bcache.nbuf, bcache.nbufmax, bcache.ndirty, hit, miss, evict);
+  cprintf("bcache: %d blocks read ahead, %d pages added, %d reclaimed\n",
+          ra, bcache.ngrow, bcache.nreclaim);
+}
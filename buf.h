@@ -1,13 +1,19 @@
 struct buf {
   int flags;
   uint dev;
-  uint sector;
+  uint blockno;
+  struct sleeplock lock;
+  uint refcnt;
+  int used;         // released since the recycler last looked
+  struct buf *hnext; // hash chain
   struct buf *prev; // LRU cache list
   struct buf *next;
   struct buf *qnext; // disk queue
-  uchar data[512];
+  uint deadline;    // tick by which a read should be started
+  uchar *data;      // BSIZE bytes, in a page shared with other bufs
 };
-#define B_BUSY  0x1  // buffer is locked by some process
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
+#define B_ASYNC 0x8  // ideintr releases buffer when I/O is done
+#define B_LOGGED 0x10 // changed by the open transaction (see log.c)
 
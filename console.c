@@ -7,6 +7,7 @@
 #include "param.h"
 #include "traps.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "fs.h"
 #include "file.h"
 #include "mmu.h"
@@ -187,6 +188,18 @@ consoleintr(int (*getc)(void))
     case C('P'):  // Process listing.
       procdump();
       break;
+    case C('L'):  // Lock statistics.
+      lockdump();
+      break;
+    case C('B'):  // Buffer cache statistics.
+      bcachedump();
+      break;
+    case C('T'):  // Disk statistics.
+      idedump();
+      break;
+    case C('N'):  // Directory entry cache statistics.
+      dcachedump();
+      break;
     case C('U'):  // Kill line.
       while(input.e != input.w &&
             input.buf[(input.e-1) % INPUT_BUF] != '\n'){
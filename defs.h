@@ -2,10 +2,13 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct iovec;
 struct pipe;
 struct proc;
 struct spinlock;
+struct sleeplock;
 struct stat;
+struct superblock;
 struct page __attribute__((packed));
 struct page_dir;
 
@@ -14,6 +17,16 @@ void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bdwrite(struct buf*);
+struct buf*     bnew(uint, uint);
+void            bforget(uint, uint);
+void            breada(uint, uint);
+void            biodone(struct buf*);
+void            bsync(uint);
+void            bpin(struct buf*);
+void            bunpin(struct buf*);
+void            bflusher(void) __attribute__((noreturn));
+void            bcachedump(void);
 
 // console.c
 void            consoleinit(void);
@@ -31,23 +44,36 @@ struct file*    filedup(struct file*);
 void            fileinit(void);
 int             fileread(struct file*, char*, int n);
 int             filestat(struct file*, struct stat*);
+int             filesync(struct file*);
 int             filewrite(struct file*, char*, int n);
+int             filereadv(struct file*, struct iovec*, int, int);
+int             filewritev(struct file*, struct iovec*, int, int);
+int             filesend(struct file*, struct file*, int);
 
 // fs.c
+void            dcachedump(void);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
+void            dirunlink(struct inode*, char*, uint);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
+int             isdirempty(struct inode*);
 void            iinit(void);
 void            ilock(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
+void            fsinit(uint);
+void            bcommitted(void);
+int             bpending(void);
+void            iflush(struct inode*);
+void            isync(void);
 int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, char*, uint, uint);
+int             sendi(struct inode*, uint, uint, int (*)(void*, char*, int), void*);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
 
@@ -55,6 +81,9 @@ int             writei(struct inode*, char*, uint, uint);
 void            ideinit(void);
 void            ideintr(void);
 void            iderw(struct buf*);
+void            idedump(void);
+void            readswapblock(int, char*);
+void            writeswapblock(int, char*);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
@@ -64,6 +93,8 @@ void            ioapicinit(void);
 // kalloc.c
 char*           kalloc(int);
 void            kfree(char*, int);
+int             kfreecount(void);
+void            kreclaimer(int (*)(int));
 void            kinit(int);
 void		*vmalloc(uint);
 void		vfree(void*);
@@ -71,6 +102,14 @@ void		vfree(void*);
 // kbd.c
 void            kbdintr(void);
 
+// log.c
+void            initlog(uint, struct superblock*);
+void            begin_op(void);
+void            end_op(void);
+void            logsync(void);
+void            log_write(struct buf*);
+int             inlog(uint);
+
 // lapic.c
 int             cpunum(void);
 extern volatile uint*    lapic;
@@ -85,6 +124,11 @@ int             mpbcpu(void);
 void            mpinit(void);
 void            mpstartthem(void);
 
+// pci.c
+uint            pciread(uint, int);
+void            pciwrite(uint, int, uint);
+int             pcifind(int, int, uint*);
+
 // picirq.c
 void            picenable(int);
 void            picinit(void);
@@ -94,6 +138,8 @@ int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
 int             pipewrite(struct pipe*, char*, int);
+int             pipewait(struct pipe*);
+int             pipeput(struct pipe*, char*, int);
 
 // proc.c
 struct proc*    copyproc(struct proc*);
@@ -101,6 +147,7 @@ void            exit(void);
 int             fork(void);
 int             growproc(int);
 int             kill(int);
+void            kthread(char*, void (*)(void));
 void            pinit(void);
 void            procdump(void);
 void            scheduler(void) __attribute__((noreturn));
@@ -115,11 +162,19 @@ void            yield(void);
 // swtch.S
 void            swtch(struct context**, struct context*);
 
+// sleeplock.c
+void            acquiresleep(struct sleeplock*);
+void            releasesleep(struct sleeplock*);
+int             holdingsleep(struct sleeplock*);
+void            disownsleep(struct sleeplock*);
+void            initsleeplock(struct sleeplock*, char*);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 void            getcallerpcs(void*, uint*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
+void            lockdump(void);
 void            release(struct spinlock*);
 void            pushcli();
 void            popcli();
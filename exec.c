@@ -20,8 +20,11 @@ exec(char *path, char **argv)
   mem = 0;
   sz = 0;
 
-  if((ip = namei(path)) == 0)
+  begin_op();
+  if((ip = namei(path)) == 0){
+    end_op();
     return -1;
+  }
   ilock(ip);
 
   // Check ELF header
@@ -77,6 +80,7 @@ exec(char *path, char **argv)
     memset(mem + ph.va + ph.filesz, 0, ph.memsz - ph.filesz);
   }
   iunlockput(ip);
+  end_op();
   
   // Initialize stack.
   sp = sz;
@@ -123,5 +127,6 @@ exec(char *path, char **argv)
   if(mem)
     kfree(mem, sz);
   iunlockput(ip);
+  end_op();
   return -1;
 }
@@ -2,3 +2,9 @@
 #define O_WRONLY  0x001
 #define O_RDWR    0x002
 #define O_CREATE  0x200
+
+// One buffer of a readv or writev.
+struct iovec {
+  void *base;
+  uint len;
+};
@@ -1,9 +1,12 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "stat.h"
 #include "fs.h"
-#include "file.h"
 #include "spinlock.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "fcntl.h"
 
 struct devsw devsw[NDEV];
 struct {
@@ -67,8 +70,11 @@ fileclose(struct file *f)
   
   if(ff.type == FD_PIPE)
     pipeclose(ff.pipe, ff.writable);
-  else if(ff.type == FD_INODE)
+  else if(ff.type == FD_INODE){
+    begin_op();
     iput(ff.ip);
+    end_op();
+  }
 }
 
 // Get metadata about file f.
@@ -84,45 +90,265 @@ filestat(struct file *f, struct stat *st)
   return -1;
 }
 
+// Write file f's modified blocks to disk.
+// The buffer cache does not know which blocks belong
+// to which file, so this commits the log and writes back
+// the whole device.
+int
+filesync(struct file *f)
+{
+  if(f->type == FD_INODE){
+    begin_op();
+    ilock(f->ip);
+    iflush(f->ip);
+    iunlock(f->ip);
+    end_op();
+    logsync();
+    bsync(f->ip->dev);
+    return 0;
+  }
+  return -1;
+}
+
 // Read from file f.  Addr is kernel address.
 int
 fileread(struct file *f, char *addr, int n)
 {
-  int r;
+  struct iovec iov;
+
+  iov.base = addr;
+  iov.len = n;
+  return filereadv(f, &iov, 1, -1);
+}
+
+// Write to file f.  Addr is kernel address.
+int
+filewrite(struct file *f, char *addr, int n)
+{
+  struct iovec iov;
+
+  iov.base = addr;
+  iov.len = n;
+  return filewritev(f, &iov, 1, -1);
+}
+
+// Read from file f into the n buffers of iov, which hold
+// kernel addresses, at offset off, or at f->off and advancing
+// it if off is -1.  A pipe fills only the first buffer that
+// is not empty, so as not to wait for more than one write.
+int
+filereadv(struct file *f, struct iovec *iov, int n, int off)
+{
+  uint pos;
+  int i, r, tot;
 
   if(f->readable == 0)
     return -1;
-  if(f->type == FD_PIPE)
-    return piperead(f->pipe, addr, n);
+  if(f->type == FD_PIPE){
+    if(off != -1)
+      return -1;
+    for(i = 0; i < n && iov[i].len == 0; i++)
+      ;
+    return i < n ? piperead(f->pipe, iov[i].base, iov[i].len) : 0;
+  }
   if(f->type == FD_INODE){
     ilock(f->ip);
-    if((r = readi(f->ip, addr, f->off, n)) > 0)
-      f->off += r;
+    pos = off == -1 ? f->off : off;
+    tot = 0;
+    for(i = 0; i < n; i++){
+      if((r = readi(f->ip, iov[i].base, pos, iov[i].len)) < 0){
+        if(tot == 0)
+          tot = -1;
+        break;
+      }
+      pos += r;
+      tot += r;
+      if(r < iov[i].len)
+        break;
+    }
+    if(off == -1)
+      f->off = pos;
     iunlock(f->ip);
-    return r;
+    return tot;
   }
   panic("fileread");
 }
 
-// Write to file f.  Addr is kernel address.
+// Write to file f from the n buffers of iov, which hold kernel
+// addresses, at offset off, or at f->off and advancing it if
+// off is -1.
 int
-filewrite(struct file *f, char *addr, int n)
+filewritev(struct file *f, struct iovec *iov, int n, int off)
 {
-//	cprintf(" -- filewrite -- f-type %d\n", f->type);
-  int r;
+  int r, i, tot, n1, max, done, len, retried;
+  uint pos;
 
   if(f->writable == 0)
     return -1;
-  if(f->type == FD_PIPE)
-    return pipewrite(f->pipe, addr, n);
+  if(f->type == FD_PIPE){
+    if(off != -1)
+      return -1;
+    for(tot = 0, i = 0; i < n; i++){
+      if((r = pipewrite(f->pipe, iov[i].base, iov[i].len)) < 0)
+        return tot > 0 ? tot : -1;
+      tot += r;
+    }
+    return tot;
+  }
   if(f->type == FD_INODE){
-    ilock(f->ip);
-    if((r = writei(f->ip, addr, f->off, n)) > 0)
-      f->off += r;
-    iunlock(f->ip);
-//	cprintf(" -- filewrite -- after iunlock \n");
-    return r;
+    // Write a few blocks at a time, so as not to exceed
+    // the log blocks one operation may use: each block
+    // may need a bitmap block, plus indirect blocks and
+    // the inode, and directory blocks are logged too.
+    // Small buffers share an operation and the inode lock.
+    max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+    r = n1 = 0;
+    tot = 0;
+    retried = 0;
+    i = 0;
+    done = 0;  // Bytes of iov[i] written
+    while(i < n){
+      begin_op();
+      ilock(f->ip);
+      pos = off == -1 ? f->off : off + tot;
+      for(len = 0; i < n && len < max; len += r){
+        n1 = iov[i].len - done;
+        if(n1 > max - len)
+          n1 = max - len;
+        if((r = writei(f->ip, (char*)iov[i].base + done, pos, n1)) > 0){
+          pos += r;
+          done += r;
+          tot += r;
+        }
+        if(r != n1)
+          break;  // error, or disk full
+        if(done == iov[i].len){
+          i++;
+          done = 0;
+        }
+      }
+      if(off == -1)
+        f->off = pos;
+      iunlock(f->ip);
+      end_op();
+      if(r != n1){
+        // The disk may be full only until the blocks the
+        // open transaction freed are committed.
+        if(retried || !bpending())
+          break;
+        retried = 1;
+        logsync();
+      }
+    }
+    return tot > 0 ? tot : r;
   }
   panic("filewrite");
 }
 
+static int
+topipe(void *arg, char *p, int n)
+{
+  return pipeput((struct pipe*)arg, p, n);
+}
+
+static int
+tofile(void *arg, char *p, int n)
+{
+  struct file *f;
+  int r;
+
+  f = arg;
+  if((r = writei(f->ip, p, f->off, n)) > 0)
+    f->off += r;
+  return r;
+}
+
+// Is ip a regular file?  A referenced inode's
+// type does not change, so this holds once checked.
+static int
+isfile(struct inode *ip)
+{
+  int r;
+
+  ilock(ip);
+  r = ip->type == T_FILE;
+  iunlock(ip);
+  return r;
+}
+
+// Copy up to n bytes from file in, at in->off, to file out, a
+// pipe or a file, in the kernel: straight from in's blocks in
+// the buffer cache into the pipe or out's blocks.  Advances
+// both offsets.  Returns the bytes copied, 0 at the end of in.
+int
+filesend(struct file *out, struct file *in, int n)
+{
+  struct inode *ip, *op, *first, *second;
+  int r, m, tot, max, eof, retried;
+
+  if(in->type != FD_INODE || in->readable == 0 || out->writable == 0 || n < 0)
+    return -1;
+  ip = in->ip;
+  r = tot = 0;
+  eof = 0;
+
+  if(out->type == FD_PIPE){
+    // Wait for room without holding ip, so that the pipe's
+    // reader can use ip meanwhile.
+    while(tot < n && !eof){
+      if((m = r = pipewait(out->pipe)) < 0)
+        break;
+      if(m > n - tot)
+        m = n - tot;
+      ilock(ip);
+      if((r = sendi(ip, in->off, m, topipe, out->pipe)) > 0){
+        in->off += r;
+        tot += r;
+      }
+      eof = r >= 0 && in->off >= ip->size;
+      iunlock(ip);
+      if(r < 0)
+        break;
+    }
+    return tot == 0 && r < 0 ? -1 : tot;
+  }
+
+  if(out->type == FD_INODE){
+    // A few blocks per log operation, as in filewritev.
+    // Both inodes must be regular files, which nothing else
+    // locks two of at once, so that locking them in inode
+    // number order cannot deadlock.
+    op = out->ip;
+    if(op == ip || !isfile(ip) || !isfile(op))
+      return -1;
+    first = ip->inum < op->inum ? ip : op;
+    second = first == ip ? op : ip;
+    max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+    retried = 0;
+    while(tot < n && !eof){
+      m = n - tot;
+      if(m > max)
+        m = max;
+      begin_op();
+      ilock(first);
+      ilock(second);
+      if((r = sendi(ip, in->off, m, tofile, out)) > 0){
+        in->off += r;
+        tot += r;
+      }
+      eof = r >= 0 && in->off >= ip->size;
+      iunlock(second);
+      iunlock(first);
+      end_op();
+      if(r < m && !eof){
+        // Error, or disk full; see filewritev.
+        if(retried || !bpending())
+          break;
+        retried = 1;
+        logsync();
+      }
+    }
+    return tot == 0 && r < 0 ? -1 : tot;
+  }
+  return -1;
+}
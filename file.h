@@ -15,18 +15,30 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
-  int flags;          // I_BUSY, I_VALID
+  struct inode *hnext; // Next in icache hash chain
+  struct sleeplock lock;
+  int flags;          // I_VALID, I_DIRTY
+  uint ranext;        // Block a sequential reader reads next
+  uint rawin;         // Read-ahead window, in blocks
+  uint raend;         // Blocks before this have been read ahead
+  uint leaf;          // Last single-indirect block bmap used, or 0
+  uint leafbase;      // First block, past NDIRECT, that leaf maps
 
   short type;         // copy of disk inode
   short major;
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint layout;
+  union {
+    uint addrs[NDIRECT+NLEVEL];
+    char data[NINLINE];
+  };
 };
 
-#define I_BUSY 0x1
 #define I_VALID 0x2
+#define I_DIRTY 0x4   // Newer than the disk inode: iflush it
+#define I_MAPPED 0x8  // Block map changed: iupdate it in this operation
 
 
 // device implementations
@@ -4,7 +4,8 @@
 //   + Directories: inode with special contents (list of other inodes!)
 //   + Names: paths like /usr/rtm/xv6/fs.c for convenient naming.
 //
-// Disk layout is: superblock, inodes, block in-use bitmap, data blocks.
+// Disk layout is: boot block, superblock, inodes, block in-use
+// bitmap, log, data blocks.
 //
 // This file contains the low-level file system manipulation 
 // routines.  The (higher-level) system call implementations
@@ -14,15 +15,19 @@
 #include "defs.h"
 #include "param.h"
 #include "stat.h"
+#include "x86.h"
 #include "mmu.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "buf.h"
 #include "fs.h"
 #include "file.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 static void itrunc(struct inode*);
+static void dcacheinit(void);
+static void dcachepurge(uint, uint);
 
 // Read the super block.
 static void
@@ -33,69 +38,302 @@ readsb(int dev, struct superblock *sb)
   bp = bread(dev, 1);
   memmove(sb, bp->data, sizeof(*sb));
   brelse(bp);
+  if(sb->bsize != BSIZE)
+    panic("readsb: wrong block size");
 }
 
-// Zero a block.
+// Zero a block, without reading it.  If the block is still in
+// the log, log it again, so that recovery cannot put back its
+// old contents over what is written to it now.
 static void
 bzero(int dev, int bno)
 {
   struct buf *bp;
   
-  bp = bread(dev, bno);
-  memset(bp->data, 0, BSIZE);
-  bwrite(bp);
+  bp = bnew(dev, bno);
+  if(inlog(bno))
+    log_write(bp);
   brelse(bp);
 }
 
 // Blocks. 
-
-// Allocate a disk block.
-static uint
-balloc(uint dev)
+//
+// The superblock of the file system is kept in memory, along
+// with a summary of the free-block bitmap: the number of free
+// blocks each bitmap block maps, and a hint below which that
+// bitmap block has no free bits.  balloc skips full bitmap
+// blocks without reading them, starts scanning at the hint,
+// and tests 32 bits at a time, finding a free one with bsf.
+// Both are loaded by the first getsb.  A bitmap block's
+// summary changes only while its buf is locked, so it agrees
+// with the bitmap; fs.lock protects the counts themselves.
+//
+// Free blocks hold garbage: bfree only clears the bitmap bit
+// and drops any cached copy of the block, and balloc zeroes
+// the block in the buffer cache, without reading it.
+//
+// A block freed by the open log transaction must not be reused
+// until the transaction commits: were the new owner's data
+// written to it first, a crash would leave it holding that data
+// but still belonging to the old owner.  So the first bfree in a
+// bitmap block in a transaction saves a copy of the block as it
+// was, and balloc takes only blocks free in both.  The copies'
+// memory is allocated by fsload, so that bfree cannot fail.
+// Until the commit such blocks count in nbusy, not nfree, so
+// nfree 0 means the disk is full; an operation that runs out
+// of blocks while bpending() can commit and try again.
+//
+// There is no inode bitmap on the disk, so fsload builds one
+// in memory from the inode blocks: a set bit is an inode in
+// use.  ialloc takes the first clear bit at or after a rotor,
+// so it reads just the one inode block it allocates from, and
+// iput clears the bit once the freed inode's type 0 is in the
+// buffer cache.
+
+#define NBMAP 32   // Most bitmap blocks: disks up to NBMAP*BPB blocks
+#define NIMAP 128  // Words of inode bitmap: up to NIMAP*32 inodes
+
+static struct {
+  struct sleeplock loadlock;  // Held while loading
+  volatile int loaded;
+  uint dev;
+  struct superblock sb;
+  struct spinlock lock;
+  uint nfree;                 // Free blocks
+  uint nbusy;                 // Freed by the open transaction
+  struct {
+    uint nfree;               // Free blocks this bitmap block maps
+    uint nbusy;               // Of its blocks, freed by the open transaction
+    uint hint;                // No free bit in it below this one
+    uchar *busy;              // Bits before this transaction's frees
+    int copied;               // busy is a copy for this transaction
+  } bmap[NBMAP];
+  uint nifree;                // Free inodes
+  uint irotor;                // Inode number to try first
+  uint imap[NIMAP];           // Inode bitmap
+} fs;
+
+// Read the superblock of dev, recover from the log, and
+// summarize the bitmap and the inodes.
+static void
+fsload(uint dev)
 {
-  int b, bi, m;
   struct buf *bp;
-  struct superblock sb;
+  struct dinode *dip;
+  uint i, bi, nb, n, *w;
+
+  readsb(dev, &fs.sb);
+  initlog(dev, &fs.sb);
+  nb = (fs.sb.size + BPB - 1) / BPB;
+  if(nb > NBMAP)
+    panic("fsload: disk too big");
+  if(fs.sb.ninodes > NIMAP*32)
+    panic("fsload: too many inodes");
+  fs.nfree = 0;
+  for(i = 0; i < nb; i++){
+    n = min(BPB, fs.sb.size - i*BPB);
+    if((fs.bmap[i].busy = (uchar*)kalloc(BSIZE)) == 0)
+      panic("fsload: no memory");
+    fs.bmap[i].nfree = 0;
+    fs.bmap[i].hint = n;
+    bp = bread(dev, BBLOCK(i*BPB, fs.sb.ninodes));
+    w = (uint*)bp->data;
+    for(bi = 0; bi < n; bi++){
+      if(bi % 32 == 0 && w[bi/32] == ~0U && bi + 32 <= n){
+        bi += 31;
+        continue;
+      }
+      if((w[bi/32] & (1 << (bi%32))) == 0){
+        if(fs.bmap[i].nfree++ == 0)
+          fs.bmap[i].hint = bi;
+      }
+    }
+    brelse(bp);
+    fs.nfree += fs.bmap[i].nfree;
+  }
 
+  // Inode 0 and those past ninodes are never free.
+  memset(fs.imap, 0xff, sizeof(fs.imap));
+  fs.nifree = 0;
+  fs.irotor = 1;
   bp = 0;
-  readsb(dev, &sb);
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb.ninodes));
-    for(bi = 0; bi < BPB; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use on disk.
-        bwrite(bp);
+  for(i = 1; i < fs.sb.ninodes; i++){
+    if(bp == 0 || i % IPB == 0){
+      if(bp)
         brelse(bp);
-        return b + bi;
-      }
+      bp = bread(dev, IBLOCK(i));
+    }
+    dip = (struct dinode*)bp->data + i%IPB;
+    if(dip->type == 0){
+      fs.imap[i/32] &= ~(1 << (i%32));
+      fs.nifree++;
     }
+  }
+  if(bp)
     brelse(bp);
+
+  fs.dev = dev;
+  xchg((uint*)&fs.loaded, 1);
+  cprintf("fs: %d blocks, %d free; %d inodes, %d free\n",
+          fs.sb.size, fs.nfree, fs.sb.ninodes, fs.nifree);
+}
+
+// Return the in-core superblock of dev, loading it on first use.
+// Only one file system, on ROOTDEV, is ever in use.
+static struct superblock*
+getsb(uint dev)
+{
+  if(!fs.loaded){
+    acquiresleep(&fs.loadlock);
+    if(!fs.loaded)
+      fsload(dev);
+    releasesleep(&fs.loadlock);
   }
-  panic("balloc: out of blocks");
+  if(dev != fs.dev)
+    panic("getsb: dev");
+  return &fs.sb;
+}
+
+// Load the file system on dev, replaying its log, before
+// anything else reads it.  Called by the first process
+// when it first runs.
+void
+fsinit(uint dev)
+{
+  getsb(dev);
+}
+
+// Index of the first bit at or after from and before limit that
+// is clear in bitmap block map and, unless it is 0, in busy;
+// or -1.
+static int
+bscan(uchar *map, uchar *busy, uint from, uint limit)
+{
+  uint *w, *c, x, k, bi;
+
+  w = (uint*)map;
+  c = (uint*)busy;
+  for(k = from/32; k*32 < limit; k++){
+    x = ~(w[k] | (c ? c[k] : 0));
+    if(k == from/32)
+      x &= ~0U << (from%32);
+    if(x != 0){
+      bi = k*32 + bsf(x);
+      return bi < limit ? bi : -1;
+    }
+  }
+  return -1;
+}
+
+// Allocate a disk block: the first free one at or after goal,
+// wrapping round to block 0.  Returns 0 if the disk is full.
+static uint
+balloc(uint dev, uint goal)
+{
+  struct superblock *sb;
+  struct buf *bp;
+  uint i, n, nb, from;
+  int bi;
+
+  sb = getsb(dev);
+  if(fs.nfree == 0)
+    return 0;
+  nb = (sb->size + BPB - 1) / BPB;
+  if(goal >= sb->size)
+    goal = 0;
+
+  // Goal's bitmap block from goal, then each bitmap block in
+  // turn, ending with goal's again for the bits below goal.
+  for(n = 0; n <= nb; n++){
+    i = (goal/BPB + n) % nb;
+    if(fs.bmap[i].nfree == 0)
+      continue;
+    bp = bread(dev, BBLOCK(i*BPB, sb->ninodes));
+    from = fs.bmap[i].hint;
+    if(n == 0 && goal % BPB > from)
+      from = goal % BPB;
+    bi = bscan(bp->data, fs.bmap[i].copied ? fs.bmap[i].busy : 0,
+               from, min(BPB, sb->size - i*BPB));
+    if(bi >= 0){
+      bp->data[bi/8] |= 1 << (bi % 8);  // Mark block in use on disk.
+      acquire(&fs.lock);
+      fs.nfree--;
+      fs.bmap[i].nfree--;
+      if(bi == fs.bmap[i].hint)
+        fs.bmap[i].hint = bi + 1;
+      release(&fs.lock);
+      log_write(bp);
+      brelse(bp);
+      bzero(dev, i*BPB + bi);
+      return i*BPB + bi;
+    }
+    brelse(bp);
+  }
+  return 0;
 }
 
 // Free a disk block.
 static void
 bfree(int dev, uint b)
 {
+  struct superblock *sb;
   struct buf *bp;
-  struct superblock sb;
   int bi, m;
 
-  bzero(dev, b);
+  bforget(dev, b);
 
-  readsb(dev, &sb);
-  bp = bread(dev, BBLOCK(b, sb.ninodes));
+  sb = getsb(dev);
+  bp = bread(dev, BBLOCK(b, sb->ninodes));
   bi = b % BPB;
   m = 1 << (bi % 8);
   if((bp->data[bi/8] & m) == 0)
     panic("freeing free block");
+  if(!fs.bmap[b/BPB].copied){
+    memmove(fs.bmap[b/BPB].busy, bp->data, BSIZE);
+    fs.bmap[b/BPB].copied = 1;
+  }
   bp->data[bi/8] &= ~m;  // Mark block free on disk.
-  bwrite(bp);
+  acquire(&fs.lock);
+  fs.nbusy++;
+  fs.bmap[b/BPB].nbusy++;
+  if(bi < fs.bmap[b/BPB].hint)
+    fs.bmap[b/BPB].hint = bi;
+  release(&fs.lock);
+  log_write(bp);
   brelse(bp);
 }
 
+// The open transaction has committed: the blocks
+// it freed may be reused.  Called by commit.
+void
+bcommitted(void)
+{
+  int i;
+
+  acquire(&fs.lock);
+  for(i = 0; i < NBMAP; i++){
+    fs.bmap[i].copied = 0;
+    fs.bmap[i].nfree += fs.bmap[i].nbusy;
+    fs.bmap[i].nbusy = 0;
+  }
+  fs.nfree += fs.nbusy;
+  fs.nbusy = 0;
+  release(&fs.lock);
+}
+
+// Are there blocks that the open transaction freed, which
+// balloc can use once it commits?
+int
+bpending(void)
+{
+  int r;
+
+  acquire(&fs.lock);
+  r = fs.nbusy > 0;
+  release(&fs.lock);
+  return r;
+}
+
 // Inodes.
 //
 // An inode is a single, unnamed file in the file system.
@@ -110,15 +348,23 @@ bfree(int dev, uint b)
 // 
 // ip->ref counts the number of pointer references to this cached
 // inode; references are typically kept in struct file and in proc->cwd.
-// When ip->ref falls to zero, the inode is no longer cached.
+// When ip->ref falls to zero the inode stays cached, so that the
+// next iget can reuse it, until its slot is needed for another inode.
 // It is an error to use an inode without holding a reference to it.
 //
+// The cache is hashed by (dev, inum).  A lookup that hits takes no
+// lock: iget walks the hash chain, takes a reference with cmpxchg,
+// and then checks icache.seq, a sequence count that writers make
+// odd while they move an inode to another chain.  If the count
+// changed the lookup is retried under icache.lock.  Reference
+// counts are only changed atomically, since lookups do not hold
+// the lock; a slot is recycled only by moving its ref from 0 to 1.
+//
 // Processes are only allowed to read and write inode
-// metadata and contents when holding the inode's lock,
-// represented by the I_BUSY flag in the in-memory copy.
+// metadata and contents when holding the inode's lock, ip->lock.
 // Because inode locks are held during disk accesses, 
-// they are implemented using a flag rather than with
-// spin locks.  Callers are responsible for locking
+// they are sleep-locks rather than spin locks.
+// Callers are responsible for locking
 // inodes before passing them to routines in this file; leaving
 // this responsibility with the caller makes it possible for them
 // to create arbitrarily-sized atomic operations.
@@ -129,45 +375,113 @@ bfree(int dev, uint b)
 // responsibility to lock them before using them.  A non-zero
 // ip->ref keeps these unlocked inodes in the cache.
 
+#define NIHASH  31
+#define IHASH(dev, inum)  (((dev) * 7 + (inum)) % NIHASH)
+
 struct {
-  struct spinlock lock;
+  struct spinlock lock;  // Serializes writers of hash and seq
+  volatile uint seq;     // Odd while a writer rearranges hash chains
+  uint hand;             // Next slot to consider for recycling
+  struct inode *hash[NIHASH];
   struct inode inode[NINODE];
 } icache;
 
 void
 iinit(void)
 {
+  int i;
+
   initlock(&icache.lock, "icache");
+  initsleeplock(&fs.loadlock, "fs");
+  initlock(&fs.lock, "fs");
+  dcacheinit();
+  for(i = 0; i < NINODE; i++)
+    initsleeplock(&icache.inode[i].lock, "inode");
 }
 
 static struct inode* iget(uint dev, uint inum);
 
+// Take a free inode number from the inode bitmap, or return 0.
+static uint
+imapalloc(void)
+{
+  uint k, w, x, inum, nw;
+
+  nw = (fs.sb.ninodes + 31) / 32;
+  acquire(&fs.lock);
+  if(fs.nifree == 0){
+    release(&fs.lock);
+    return 0;
+  }
+  for(k = 0; k <= nw; k++){
+    w = (fs.irotor/32 + k) % nw;
+    x = ~fs.imap[w];
+    if(k == 0)
+      x &= ~0U << (fs.irotor%32);  // bits at or after the rotor
+    if(x){
+      inum = w*32 + bsf(x);
+      fs.imap[w] |= 1 << (inum%32);
+      fs.nifree--;
+      fs.irotor = inum + 1 < fs.sb.ninodes ? inum + 1 : 1;
+      release(&fs.lock);
+      return inum;
+    }
+  }
+  panic("imapalloc");
+}
+
+// Return inode inum to the inode bitmap.
+static void
+imapfree(uint inum)
+{
+  acquire(&fs.lock);
+  if((fs.imap[inum/32] & (1 << (inum%32))) == 0)
+    panic("imapfree");
+  fs.imap[inum/32] &= ~(1 << (inum%32));
+  fs.nifree++;
+  release(&fs.lock);
+}
+
 // Allocate a new inode with the given type on device dev.
 struct inode*
 ialloc(uint dev, short type)
 {
-  int inum;
+  uint inum;
   struct buf *bp;
   struct dinode *dip;
-  struct superblock sb;
-
-  readsb(dev, &sb);
-  for(inum = 1; inum < sb.ninodes; inum++){  // loop over inode blocks
-    bp = bread(dev, IBLOCK(inum));
-    dip = (struct dinode*)bp->data + inum%IPB;
-    if(dip->type == 0){  // a free inode
-      memset(dip, 0, sizeof(*dip));
-      dip->type = type;
-      bwrite(bp);   // mark it allocated on the disk
-      brelse(bp);
-      return iget(dev, inum);
-    }
-    brelse(bp);
-  }
-  panic("ialloc: no inodes");
+  struct superblock *sb;
+
+  sb = getsb(dev);
+  if((inum = imapalloc()) == 0)
+    panic("ialloc: no inodes");
+  bp = bread(dev, IBLOCK(inum));
+  dip = (struct dinode*)bp->data + inum%IPB;
+  if(dip->type != 0)
+    panic("ialloc: inode in use");
+  memset(dip, 0, sizeof(*dip));
+  dip->type = type;
+  dip->layout = sb->layout;
+  if(type != T_DIR)
+    dip->layout &= ~L_HASHED;
+  if(type != T_FILE)
+    dip->layout &= ~L_INLINE;
+  log_write(bp);   // mark it allocated on the disk
+  brelse(bp);
+  return iget(dev, inum);
 }
 
 // Copy inode, which has changed, from memory to disk.
+// Caller must hold ip->lock.
+//
+// writei, which changes the size with nearly every call, sets
+// I_DIRTY instead.  A dirty inode is copied by iflush when it
+// is synced, when its last reference is dropped, or by the
+// flusher thread, just before it commits the log (see isync).
+// Like iupdate, these run inside a log operation.  A change to
+// the block map is not deferred: bmap sets I_MAPPED, and writei
+// then logs the inode in the same operation as the bitmap and
+// indirect blocks, so that no commit has blocks allocated to
+// an inode that does not name them.
 void
 iupdate(struct inode *ip)
 {
@@ -181,9 +495,96 @@ iupdate(struct inode *ip)
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
   dip->size = ip->size;
-  memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
-  bwrite(bp);
+  dip->layout = ip->layout;
+  memmove(dip->data, ip->data, sizeof(ip->data));
+  log_write(bp);
   brelse(bp);
+  ip->flags &= ~(I_DIRTY|I_MAPPED);
+}
+
+// Copy ip to disk if it is dirty.  Caller must hold ip->lock.
+void
+iflush(struct inode *ip)
+{
+  if(ip->flags & I_DIRTY)
+    iupdate(ip);
+}
+
+// Flush every dirty inode in the cache, each in a
+// log operation of its own.
+void
+isync(void)
+{
+  struct inode *ip;
+
+  for(ip = icache.inode; ip < icache.inode+NINODE; ip++){
+    // Only referenced inodes are dirty, and holding
+    // icache.lock keeps the slot from being recycled
+    // until the reference is taken.
+    acquire(&icache.lock);
+    if(ip->ref == 0 || !(ip->flags & I_DIRTY)){
+      release(&icache.lock);
+      continue;
+    }
+    xaddl((uint*)&ip->ref, 1);
+    release(&icache.lock);
+    begin_op();
+    acquiresleep(&ip->lock);
+    iflush(ip);
+    releasesleep(&ip->lock);
+    iput(ip);
+    end_op();
+  }
+}
+
+// Look for a cached inode without taking icache.lock.
+// Returns it with an extra reference, or 0 if it is not
+// cached or a writer got in the way.
+static struct inode*
+ilookup(uint dev, uint inum)
+{
+  struct inode *ip;
+  uint seq;
+  int n, ref;
+
+  seq = icache.seq;
+  if(seq & 1)
+    return 0;
+  // Keep gcc from hoisting the chain walk above the seq read.
+  asm volatile("" ::: "memory");
+
+  // A chain walked during an update may be garbled;
+  // n bounds the walk, the seq check catches the rest.
+  ip = icache.hash[IHASH(dev, inum)];
+  for(n = 0; ip != 0 && n < NINODE; ip = ip->hnext, n++){
+    if(ip->dev != dev || ip->inum != inum)
+      continue;
+    do {
+      ref = ip->ref;
+    } while(cmpxchg((uint*)&ip->ref, ref, ref+1) != ref);
+    if(icache.seq == seq)
+      return ip;
+    // The slot may have been renamed under us.
+    iput(ip);
+    return 0;
+  }
+  return 0;
+}
+
+// Remove ip from the hash chain for its current identity.
+// Caller holds icache.lock with icache.seq odd.
+static void
+iunhash(struct inode *ip)
+{
+  struct inode **pp;
+
+  for(pp = &icache.hash[IHASH(ip->dev, ip->inum)]; *pp; pp = &(*pp)->hnext){
+    if(*pp == ip){
+      *pp = ip->hnext;
+      break;
+    }
+  }
+  ip->hnext = 0;
 }
 
 // Find the inode with number inum on device dev
@@ -191,34 +592,51 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
+  int i;
+
+  if((ip = ilookup(dev, inum)) != 0)
+    return ip;
 
   acquire(&icache.lock);
 
-  // Try for cached inode.
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  // Try for cached inode again; the lock-free lookup can miss
+  // an inode that is being added or moved.
+  for(ip = icache.hash[IHASH(dev, inum)]; ip != 0; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      xaddl((uint*)&ip->ref, 1);
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Allocate fresh inode.
-  if(empty == 0)
-    panic("iget: no inodes");
-
-  ip = empty;
-  ip->dev = dev;
-  ip->inum = inum;
-  ip->ref = 1;
-  ip->flags = 0;
-  release(&icache.lock);
-
-  return ip;
+  // Recycle an unreferenced slot, sweeping round from icache.hand.
+  // Readers may take a reference at any moment, so claim the slot
+  // with cmpxchg only after making seq odd: a reader that got in
+  // first makes the claim fail, one that gets in later fails its
+  // seq check.
+  for(i = 0; i < NINODE; i++){
+    ip = &icache.inode[icache.hand];
+    icache.hand = (icache.hand + 1) % NINODE;
+    if(ip->ref != 0)
+      continue;
+    icache.seq++;
+    if(cmpxchg((uint*)&ip->ref, 0, 1) == 0){
+      iunhash(ip);
+      ip->dev = dev;
+      ip->inum = inum;
+      ip->flags = 0;
+      ip->ranext = ip->rawin = ip->raend = 0;
+      ip->leaf = 0;
+      ip->hnext = icache.hash[IHASH(dev, inum)];
+      icache.hash[IHASH(dev, inum)] = ip;
+      icache.seq++;
+      release(&icache.lock);
+      return ip;
+    }
+    icache.seq++;
+  }
+  panic("iget: no inodes");
 }
 
 // Increment reference count for ip.
@@ -226,9 +644,7 @@ iget(uint dev, uint inum)
 struct inode*
 idup(struct inode *ip)
 {
-  acquire(&icache.lock);
-  ip->ref++;
-  release(&icache.lock);
+  xaddl((uint*)&ip->ref, 1);
   return ip;
 }
 
@@ -242,11 +658,7 @@ ilock(struct inode *ip)
   if(ip == 0 || ip->ref < 1)
     panic("ilock");
 
-  acquire(&icache.lock);
-  while(ip->flags & I_BUSY)
-    sleep(ip, &icache.lock);
-  ip->flags |= I_BUSY;
-  release(&icache.lock);
+  acquiresleep(&ip->lock);
 
   if(!(ip->flags & I_VALID)){
     bp = bread(ip->dev, IBLOCK(ip->inum));
@@ -256,7 +668,8 @@ ilock(struct inode *ip)
     ip->minor = dip->minor;
     ip->nlink = dip->nlink;
     ip->size = dip->size;
-    memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
+    ip->layout = dip->layout;
+    memmove(ip->data, dip->data, sizeof(ip->data));
     brelse(bp);
     ip->flags |= I_VALID;
     if(ip->type == 0)
@@ -268,34 +681,62 @@ ilock(struct inode *ip)
 void
 iunlock(struct inode *ip)
 {
-  if(ip == 0 || !(ip->flags & I_BUSY) || ip->ref < 1)
+  if(ip == 0 || !holdingsleep(&ip->lock) || ip->ref < 1)
     panic("iunlock");
 
-  acquire(&icache.lock);
-  ip->flags &= ~I_BUSY;
-  wakeup(ip);
-  release(&icache.lock);
+  releasesleep(&ip->lock);
 }
 
 // Caller holds reference to unlocked ip.  Drop reference.
+// All calls to iput() must be inside a log operation, in case
+// it has to free or flush the inode.
 void
 iput(struct inode *ip)
 {
+  int ref;
+
+  // Drop the reference without the lock unless it is the last
+  // one to a deleted inode, which must be truncated and freed.
+  // With ref == 1 nobody else can be changing nlink.
+  // The last reference to a dirty inode flushes it first,
+  // so the slot can be recycled without losing the update.
+  for(;;){
+    ref = ip->ref;
+    if(ref == 1 && (ip->flags & I_VALID) && ip->nlink == 0)
+      break;
+    if(ref == 1 && (ip->flags & I_DIRTY)){
+      acquiresleep(&ip->lock);
+      iflush(ip);
+      releasesleep(&ip->lock);
+      continue;
+    }
+    if(cmpxchg((uint*)&ip->ref, ref, ref-1) == ref)
+      return;
+  }
+
   acquire(&icache.lock);
+  icache.seq++;
   if(ip->ref == 1 && (ip->flags & I_VALID) && ip->nlink == 0){
     // inode is no longer used: truncate and free inode.
-    if(ip->flags & I_BUSY)
-      panic("iput busy");
-    ip->flags |= I_BUSY;
+    // Unhashing it keeps lock-free lookups from finding it,
+    // so ip->ref == 1 means no other process can have ip locked,
+    // and this acquiresleep() won't block (or deadlock).
+    iunhash(ip);
+    icache.seq++;
+    acquiresleep(&ip->lock);
     release(&icache.lock);
+    if(ip->type == T_DIR)
+      dcachepurge(ip->dev, ip->inum);
     itrunc(ip);
     ip->type = 0;
     iupdate(ip);
-    acquire(&icache.lock);
+    imapfree(ip->inum);
     ip->flags = 0;
-    wakeup(ip);
-  }
-  ip->ref--;
+    releasesleep(&ip->lock);
+    acquire(&icache.lock);
+  } else
+    icache.seq++;
+  xaddl((uint*)&ip->ref, -1);
   release(&icache.lock);
 }
 
@@ -312,38 +753,212 @@ iunlockput(struct inode *ip)
 // The contents (data) associated with each inode is stored
 // in a sequence of blocks on the disk.  The first NDIRECT blocks
 // are listed in ip->addrs[].  The next NINDIRECT blocks are 
-// listed in the block ip->addrs[INDIRECT].
+// listed in the single-indirect block ip->addrs[NDIRECT].
+// The NDINDIRECT after those are reached through the
+// double-indirect block ip->addrs[NDIRECT+1], whose entries
+// are single-indirect blocks, and the NTINDIRECT after those
+// through the triple-indirect block ip->addrs[NDIRECT+2].
+//
+// Sequential access walks the same single-indirect block
+// NINDIRECT times in a row, so bmap remembers the last one it
+// used in ip->leaf and goes straight to it when it can.
+//
+// If ip->layout has L_EXTENTS, ip->addrs holds extents instead
+// (see fs.h).  A block appended to such a file goes right
+// after the file's last block if that one is free, growing
+// the last extent, so a file written sequentially stays in
+// a few long runs.
+//
+// An L_INLINE file has no blocks at all: its data is in
+// ip->data, where readi and writei use it without touching
+// the disk, until writei moves it to a block (iuninline).
+
+// Return entry i of indirect block addr in inode ip.
+// If the entry is empty, allocate a block for it;
+// return 0 if the disk is full.
+static uint
+bindirect(struct inode *ip, uint addr, uint i)
+{
+  struct buf *bp;
+  uint *a;
+
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  if((addr = a[i]) == 0 && (addr = balloc(ip->dev, 0)) != 0){
+    a[i] = addr;
+    log_write(bp);
+  }
+  brelse(bp);
+  return addr;
+}
+
+// Return the disk block address of the nth block in
+// extent-mapped inode ip.  If bn is the block just past
+// the end of the file, emap allocates it, or returns 0 if
+// the disk is full or the file has used all its extents.
+static uint
+emap(struct inode *ip, uint bn)
+{
+  struct extent *x, *e;
+  struct buf *bp;
+  uint off, goal, addr;
+  int i, n;
+
+  // Look for the extent holding bn, in the inode and then
+  // in the extent block.  e is the last extent seen.
+  bp = 0;
+  x = (struct extent*)ip->addrs;
+  n = NEXTENT;
+  e = 0;
+  off = 0;
+  for(i = 0; ; i++){
+    if(i == n){
+      if(bp != 0 || ip->addrs[XBLOCK] == 0)
+        break;
+      bp = bread(ip->dev, ip->addrs[XBLOCK]);
+      x = (struct extent*)bp->data;
+      n = NXEXTENT;
+      i = 0;
+    }
+    if(x[i].len == 0)
+      break;
+    e = &x[i];
+    if(bn - off < e->len){
+      addr = e->start + bn - off;
+      if(bp)
+        brelse(bp);
+      return addr;
+    }
+    off += e->len;
+  }
+  if(bn != off)
+    panic("emap: hole");
+
+  // Append: grow the last extent if the block after it
+  // is free, else start a new extent at x[i].
+  goal = e ? e->start + e->len : 0;
+  if((addr = balloc(ip->dev, goal)) == 0){
+    if(bp)
+      brelse(bp);
+    return 0;
+  }
+  if(e != 0 && addr == goal)
+    e->len++;
+  else {
+    if(i == n){
+      if(bp != 0){
+        // Out of extents: the file cannot grow.
+        bfree(ip->dev, addr);
+        brelse(bp);
+        return 0;
+      }
+      if((ip->addrs[XBLOCK] = balloc(ip->dev, 0)) == 0){
+        bfree(ip->dev, addr);
+        return 0;
+      }
+      bp = bread(ip->dev, ip->addrs[XBLOCK]);
+      x = (struct extent*)bp->data;
+      i = 0;
+    }
+    x[i].start = addr;
+    x[i].len = 1;
+  }
+  if(bp){
+    log_write(bp);
+    brelse(bp);
+  }
+  ip->flags |= I_MAPPED;
+  return addr;
+}
 
 // Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// If there is no such block, bmap allocates one, or returns 0
+// if the disk is full.
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
-  struct buf *bp;
+  uint addr, span, i;
+  int level;
+
+  if(ip->layout & L_INLINE)
+    panic("bmap: inline");
+  if(ip->layout & L_EXTENTS)
+    return emap(ip, bn);
 
   if(bn < NDIRECT){
-    if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+    if((addr = ip->addrs[bn]) == 0){
+      ip->addrs[bn] = addr = balloc(ip->dev, 0);
+      ip->flags |= I_MAPPED;
+    }
     return addr;
   }
   bn -= NDIRECT;
 
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
-    bp = bread(ip->dev, addr);
-    a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
-      bwrite(bp);
-    }
-    brelse(bp);
-    return addr;
+  if(ip->leaf != 0 && bn - ip->leafbase < NINDIRECT)
+    return bindirect(ip, ip->leaf, bn - ip->leafbase);
+
+  // Find the tree that holds bn and the offset i in it:
+  // span blocks, in a tree of level+1 indirect blocks.
+  i = bn;
+  span = NINDIRECT;
+  for(level = 0; i >= span; level++){
+    if(level == NLEVEL-1)
+      panic("bmap: out of range");
+    i -= span;
+    span *= NINDIRECT;
   }
 
-  panic("bmap: out of range");
+  // Walk down to the single-indirect block,
+  // allocating blocks if necessary.
+  if((addr = ip->addrs[NDIRECT+level]) == 0){
+    ip->addrs[NDIRECT+level] = addr = balloc(ip->dev, 0);
+    ip->flags |= I_MAPPED;
+  }
+  for(; level > 0 && addr != 0; level--){
+    span /= NINDIRECT;
+    addr = bindirect(ip, addr, i / span);
+    i %= span;
+  }
+  if(addr == 0)
+    return 0;
+  ip->leaf = addr;
+  ip->leafbase = bn - i;
+  return bindirect(ip, addr, i);
+}
+
+// Free indirect block addr and the blocks it lists,
+// which are themselves indirect blocks if level > 0.
+static void
+bfreeindirect(uint dev, uint addr, int level)
+{
+  struct buf *bp;
+  uint *a;
+  int j;
+
+  bp = bread(dev, addr);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j] == 0)
+      continue;
+    if(level > 0)
+      bfreeindirect(dev, a[j], level-1);
+    else
+      bfree(dev, a[j]);
+  }
+  brelse(bp);
+  bfree(dev, addr);
+}
+
+// Free the blocks of the n extents at x.
+static void
+bfreeextents(uint dev, struct extent *x, int n)
+{
+  int i;
+  uint b;
+
+  for(i = 0; i < n && x[i].len > 0; i++)
+    for(b = x[i].start; b < x[i].start + x[i].len; b++)
+      bfree(dev, b);
 }
 
 // Truncate inode (discard contents).
@@ -352,9 +967,29 @@ bmap(struct inode *ip, uint bn)
 static void
 itrunc(struct inode *ip)
 {
-  int i, j;
+  int i;
   struct buf *bp;
-  uint *a;
+
+  if(ip->layout & L_INLINE){
+    memset(ip->data, 0, sizeof(ip->data));
+    ip->size = 0;
+    iupdate(ip);
+    return;
+  }
+
+  if(ip->layout & L_EXTENTS){
+    bfreeextents(ip->dev, (struct extent*)ip->addrs, NEXTENT);
+    if(ip->addrs[XBLOCK]){
+      bp = bread(ip->dev, ip->addrs[XBLOCK]);
+      bfreeextents(ip->dev, (struct extent*)bp->data, NXEXTENT);
+      brelse(bp);
+      bfree(ip->dev, ip->addrs[XBLOCK]);
+    }
+    memset(ip->addrs, 0, sizeof(ip->addrs));
+    ip->size = 0;
+    iupdate(ip);
+    return;
+  }
 
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
@@ -363,23 +998,41 @@ itrunc(struct inode *ip)
     }
   }
   
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
+  for(i = 0; i < NLEVEL; i++){
+    if(ip->addrs[NDIRECT+i]){
+      bfreeindirect(ip->dev, ip->addrs[NDIRECT+i], i);
+      ip->addrs[NDIRECT+i] = 0;
     }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
   }
+  ip->leaf = 0;
 
   ip->size = 0;
   iupdate(ip);
 }
 
+// Number of extents in use in extent-mapped inode ip.
+static uint
+nextents(struct inode *ip)
+{
+  struct extent *x;
+  struct buf *bp;
+  uint n;
+
+  x = (struct extent*)ip->addrs;
+  for(n = 0; n < NEXTENT && x[n].len > 0; n++)
+    ;
+  if(ip->addrs[XBLOCK]){
+    bp = bread(ip->dev, ip->addrs[XBLOCK]);
+    x = (struct extent*)bp->data;
+    for(; n < NEXTENT+NXEXTENT && x[n-NEXTENT].len > 0; n++)
+      ;
+    brelse(bp);
+  }
+  return n;
+}
+
 // Copy stat information from inode.
+// Caller must hold ip->lock.
 void
 stati(struct inode *ip, struct stat *st)
 {
@@ -388,6 +1041,47 @@ stati(struct inode *ip, struct stat *st)
   st->type = ip->type;
   st->nlink = ip->nlink;
   st->size = ip->size;
+  st->layout = ip->layout;
+  st->nextent = (ip->layout & L_EXTENTS) ? nextents(ip) : 0;
+}
+
+// Read-ahead.  A read that starts in the block where the
+// previous one ended is sequential.  Each sequential read
+// doubles the inode's window, up to RAMAX blocks, and starts
+// reading the window's blocks past the end of the read
+// without waiting for them; any other read closes the window.
+#define RAMIN   4
+#define RAMAX  32
+
+// Called by readi, before it reads bytes [off, off+n).
+static void
+readahead(struct inode *ip, uint off, uint n)
+{
+  uint bn, first, last;
+
+  if(off/BSIZE != ip->ranext){
+    ip->rawin = 0;
+    ip->raend = 0;
+  } else if(ip->rawin == 0)
+    ip->rawin = RAMIN;
+  else if(ip->rawin < RAMAX)
+    ip->rawin *= 2;
+  ip->ranext = (off + n) / BSIZE;
+  if(ip->rawin == 0)
+    return;
+
+  // The blocks of this read are read ahead too, so that
+  // they are all queued before readi waits for the first.
+  first = off/BSIZE + 1;
+  if(first < ip->raend)
+    first = ip->raend;
+  last = (off + n - 1)/BSIZE + ip->rawin;
+  if(last > (ip->size - 1)/BSIZE)
+    last = (ip->size - 1)/BSIZE;
+  for(bn = first; bn <= last; bn++)
+    breada(ip->dev, bmap(ip, bn));
+  if(last + 1 > ip->raend)
+    ip->raend = last + 1;
 }
 
 // Read data from inode.
@@ -407,6 +1101,12 @@ readi(struct inode *ip, char *dst, uint off, uint n)
     return -1;
   if(off + n > ip->size)
     n = ip->size - off;
+  if(ip->layout & L_INLINE){
+    memmove(dst, ip->data + off, n);
+    return n;
+  }
+  if(n > 0)
+    readahead(ip, off, n);
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
@@ -417,11 +1117,85 @@ readi(struct inode *ip, char *dst, uint off, uint n)
   return n;
 }
 
+// Pass up to n bytes of ip from off to fn(arg, p, m), in place
+// in the buffer cache, a block at a time.  Stops early if fn
+// takes fewer than m bytes.  Returns the bytes taken, or -1.
+// Used by sendfile.
+int
+sendi(struct inode *ip, uint off, uint n, int (*fn)(void*, char*, int), void *arg)
+{
+  uint tot, m;
+  struct buf *bp;
+  int r;
+
+  if(ip->type != T_FILE || off > ip->size || off + n < off)
+    return -1;
+  if(off + n > ip->size)
+    n = ip->size - off;
+  if(ip->layout & L_INLINE)
+    return fn(arg, ip->data + off, n);
+  if(n > 0)
+    readahead(ip, off, n);
+
+  for(tot=0; tot<n; tot+=r, off+=r){
+    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    m = min(n - tot, BSIZE - off%BSIZE);
+    r = fn(arg, (char*)bp->data + off%BSIZE, m);
+    brelse(bp);
+    if(r < 0)
+      return tot > 0 ? tot : -1;
+    if(r < m)
+      return tot + r;
+  }
+  return tot;
+}
+
+// Write back file data block bp.  File data is not logged,
+// except while the block is still in the log on disk from
+// before it was freed: then recovery would put the logged
+// copy back over the new data, unless it is logged again.
+static void
+bdatawrite(struct buf *bp)
+{
+  if(inlog(bp->blockno))
+    log_write(bp);
+  else
+    bdwrite(bp);
+}
+
+// Move the data of inline file ip to a block, so that
+// the file can grow past NINLINE bytes.  Returns -1 if
+// the disk is full.
+static int
+iuninline(struct inode *ip)
+{
+  char data[NINLINE];
+  struct buf *bp;
+  uint addr;
+
+  memmove(data, ip->data, NINLINE);
+  memset(ip->data, 0, NINLINE);
+  ip->layout &= ~L_INLINE;
+  if(ip->size > 0){
+    if((addr = bmap(ip, 0)) == 0){
+      memmove(ip->data, data, NINLINE);
+      ip->layout |= L_INLINE;
+      return -1;
+    }
+    bp = bread(ip->dev, addr);
+    memmove(bp->data, data, ip->size);
+    bdatawrite(bp);
+    brelse(bp);
+  }
+  ip->flags |= I_DIRTY;
+  return 0;
+}
+
 // Write data to inode.
 int
 writei(struct inode *ip, char *src, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, addr;
   struct buf *bp;
 
   if(ip->type == T_DEV){
@@ -432,22 +1206,45 @@ writei(struct inode *ip, char *src, uint off, uint n)
 
   if(off > ip->size || off + n < off)
     return -1;
-  if(off + n > MAXFILE*BSIZE)
+  // With big blocks MAXFILE*BSIZE does not fit in a uint,
+  // but then a uint offset cannot pass MAXFILE blocks either.
+  if(n > 0 && (off + n - 1)/BSIZE >= MAXFILE)
     n = MAXFILE*BSIZE - off;
 
+  if((ip->layout & L_INLINE) && n > 0){
+    if(off + n <= NINLINE){
+      memmove(ip->data + off, src, n);
+      if(off + n > ip->size)
+        ip->size = off + n;
+      ip->flags |= I_DIRTY;
+      return n;
+    }
+    if(iuninline(ip) < 0)
+      return -1;
+  }
+
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    if((addr = bmap(ip, off/BSIZE)) == 0)
+      break;  // disk full
+    bp = bread(ip->dev, addr);
     m = min(n - tot, BSIZE - off%BSIZE);
     memmove(bp->data + off%BSIZE, src, m);
-    bwrite(bp);
+    if(ip->type == T_DIR)
+      log_write(bp);  // Directories are metadata; file data is not logged.
+    else
+      bdatawrite(bp);
     brelse(bp);
   }
 
-  if(n > 0 && off > ip->size){
+  if(tot > 0 && off > ip->size){
     ip->size = off;
-    iupdate(ip);
+    ip->flags |= I_DIRTY;
   }
-  return n;
+  if(ip->flags & I_MAPPED)
+    iupdate(ip);
+  if(tot == 0 && n > 0)
+    return -1;
+  return tot;
 }
 
 // Directories
@@ -458,37 +1255,534 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Directory entry cache.
+//
+// The dcache remembers the results of recent dirlookups:
+// for a (directory, name) pair, the inode number and offset
+// of the entry, or that there is no such entry (inum 0).
+// A lookup that hits reads no directory blocks.
+//
+// An entry for directory dp changes only while dp is locked:
+// dirlookup adds entries, dirlink and dirunlink update them.
+// When a directory is freed its entries are purged, since its
+// inode number may be reused.  Entries are recycled round
+// robin.  dcache.lock protects the hash chains and entries.
+// Names of DCNAME bytes or more are not cached.
+
+#define NDENTRY 128
+#define NDHASH  61
+#define DCNAME  32
+
+struct dentry {
+  uint dev;
+  uint dir;             // Directory's inode number; 0 if unused
+  char name[DCNAME];
+  uint inum;            // Inode number, or 0 if there is no entry
+  uint off;             // Byte offset of the entry in dir
+  struct dentry *hnext; // Hash chain
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry *hash[NDHASH];
+  struct dentry entry[NDENTRY];
+  uint hand;            // Next entry to recycle
+  uint hit;
+  uint neghit;          // Hits that found no entry
+  uint miss;
+} dcache;
+
+static void
+dcacheinit(void)
+{
+  initlock(&dcache.lock, "dcache");
+}
+
+static uint
+dhash(uint dev, uint dir, char *name)
+{
+  uint h;
+  int i;
+
+  h = dev * 7 + dir;
+  for(i = 0; name[i]; i++)
+    h = h * 31 + (uchar)name[i];
+  return h % NDHASH;
+}
+
+// Find the entry for name in directory dir.
+// Caller holds dcache.lock.
+static struct dentry*
+dfind(uint dev, uint dir, char *name)
+{
+  struct dentry *e;
+
+  if(strlen(name) >= DCNAME)
+    return 0;
+  for(e = dcache.hash[dhash(dev, dir, name)]; e != 0; e = e->hnext)
+    if(e->dev == dev && e->dir == dir && namecmp(e->name, name) == 0)
+      return e;
+  return 0;
+}
+
+// Take e off its hash chain.  Caller holds dcache.lock.
+static void
+dunhash(struct dentry *e)
+{
+  struct dentry **pp;
+
+  for(pp = &dcache.hash[dhash(e->dev, e->dir, e->name)]; *pp != e; pp = &(*pp)->hnext)
+    ;
+  *pp = e->hnext;
+  e->dir = 0;
+}
+
+// Record that name in directory dp is inode inum at offset off,
+// or, if inum is 0, that dp has no entry for name.
+static void
+dcacheset(struct inode *dp, char *name, uint inum, uint off)
+{
+  struct dentry *e;
+  uint h;
+
+  if(strlen(name) >= DCNAME)
+    return;
+  acquire(&dcache.lock);
+  if((e = dfind(dp->dev, dp->inum, name)) == 0){
+    e = &dcache.entry[dcache.hand];
+    dcache.hand = (dcache.hand + 1) % NDENTRY;
+    if(e->dir != 0)
+      dunhash(e);
+    e->dev = dp->dev;
+    e->dir = dp->inum;
+    safestrcpy(e->name, name, DCNAME);
+    h = dhash(e->dev, e->dir, e->name);
+    e->hnext = dcache.hash[h];
+    dcache.hash[h] = e;
+  }
+  e->inum = inum;
+  e->off = off;
+  release(&dcache.lock);
+}
+
+// Drop the entries for directory dir, which is being freed.
+static void
+dcachepurge(uint dev, uint dir)
+{
+  struct dentry *e;
+
+  acquire(&dcache.lock);
+  for(e = dcache.entry; e < dcache.entry+NDENTRY; e++)
+    if(e->dir == dir && e->dev == dev)
+      dunhash(e);
+  release(&dcache.lock);
+}
+
+// Print directory entry cache statistics.  Runs when
+// user types ^N on console.  No lock, to avoid wedging
+// a stuck machine further.
+void
+dcachedump(void)
+{
+  uint n;
+
+  n = dcache.hit + dcache.miss;
+  cprintf("dcache: %d lookups, %d hits (%d negative), %d misses, hit rate %d%%\n",
+          n, dcache.hit, dcache.neghit, dcache.miss,
+          n ? dcache.hit * 100 / n : 0);
+}
+
+// Directory blocks (see fs.h).
+
+static uint
+dirhash(char *name, int len)
+{
+  uint h;
+  int i;
+
+  h = 2166136261U;  // FNV-1a
+  for(i = 0; i < len; i++){
+    h ^= (uchar)name[i];
+    h *= 16777619;
+  }
+  return h;
+}
+
+// The entry at offset off of directory block blk.
+static struct dirent*
+drec(uchar *blk, uint off)
+{
+  struct dirent *de;
+
+  de = (struct dirent*)(blk + off);
+  if(de->reclen < DIRHDR || de->reclen % 4 != 0 || off + de->reclen > BSIZE ||
+     (de->inum != 0 && DIRREC(de->namelen) > de->reclen))
+    panic("drec: bad directory entry");
+  return de;
+}
+
+// Make blk an empty directory block: one free entry.
+static void
+dblkinit(uchar *blk)
+{
+  struct dirent *de;
+
+  de = (struct dirent*)blk;
+  de->inum = 0;
+  de->reclen = BSIZE;
+}
+
+// Offset in blk of the entry for name (len bytes, hash h), or -1.
+static int
+dblkfind(uchar *blk, char *name, int len, uint h)
+{
+  struct dirent *de;
+  uint off;
+
+  for(off = 0; off < BSIZE; off += de->reclen){
+    de = drec(blk, off);
+    if(de->inum != 0 && de->hash == h && de->namelen == len &&
+       memcmp(de->name, name, len) == 0)
+      return off;
+  }
+  return -1;
+}
+
+// Add an entry to blk, in a free entry big enough or in
+// the slack after a live one.  Returns its offset, or -1
+// if blk has no room.
+static int
+dblkadd(uchar *blk, char *name, int len, uint h, uint inum)
+{
+  struct dirent *de, *nde;
+  uint off, used;
+
+  for(off = 0; off < BSIZE; off += de->reclen){
+    de = drec(blk, off);
+    used = de->inum != 0 ? DIRREC(de->namelen) : 0;
+    if(de->reclen - used >= DIRREC(len)){
+      if(used > 0){
+        nde = (struct dirent*)(blk + off + used);
+        nde->reclen = de->reclen - used;
+        de->reclen = used;
+        de = nde;
+        off += used;
+      }
+      de->inum = inum;
+      de->namelen = len;
+      de->pad = 0;
+      de->hash = h;
+      memmove(de->name, name, len);
+      return off;
+    }
+  }
+  return -1;
+}
+
+// Remove the entry at off from blk, merging its space into
+// the entry before it.  The first entry is just freed.
+static void
+dblkdel(uchar *blk, uint off)
+{
+  struct dirent *de, *prev;
+  uint o;
+
+  prev = 0;
+  for(o = 0; o < off; o += de->reclen)
+    prev = de = drec(blk, o);
+  if(o != off)
+    panic("dblkdel");
+  de = drec(blk, off);
+  if(prev)
+    prev->reclen += de->reclen;
+  else
+    de->inum = 0;
+}
+
+// Hashed directories (see fs.h).  A name lives in the block
+// of the last index entry whose hash is not above the name's,
+// so a lookup reads the index block and one other.
+
+// Number of index entries in use.
+static int
+dxend(struct dxentry *dx)
+{
+  int i;
+
+  for(i = 0; i < NDXENTRY && dx[i].block != 0; i++)
+    ;
+  return i;
+}
+
+// Index of the entry for hash h.
+static int
+dxfind(struct dxentry *dx, uint h)
+{
+  int lo, hi, mid;
+
+  lo = 0;
+  hi = dxend(dx);
+  while(hi - lo > 1){
+    mid = (lo + hi) / 2;
+    if(dx[mid].hash <= h)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// Look for name in hashed directory dp.  If found, set *poff
+// and return the inode number; else return 0.
+static uint
+dxlookup(struct inode *dp, char *name, uint *poff)
+{
+  struct buf *bp;
+  struct dxentry *dx;
+  uint bn, inum, h;
+  int len, off;
+
+  if(dp->size == 0)
+    return 0;
+  len = strlen(name);
+  h = dirhash(name, len);
+  bp = bread(dp->dev, bmap(dp, 0));
+  if((off = dblkfind(bp->data, name, len, h)) >= 0){  // "." or ".."
+    *poff = off;
+    inum = ((struct dirent*)(bp->data + off))->inum;
+    brelse(bp);
+    return inum;
+  }
+  dx = (struct dxentry*)(bp->data + DXOFF);
+  bn = dx[dxfind(dx, h)].block;
+  brelse(bp);
+
+  bp = bread(dp->dev, bmap(dp, bn));
+  inum = 0;
+  if((off = dblkfind(bp->data, name, len, h)) >= 0){
+    *poff = bn*BSIZE + off;
+    inum = ((struct dirent*)(bp->data + off))->inum;
+  }
+  brelse(bp);
+  return inum;
+}
+
+// Split the full block named by index entry i of index block
+// bpi, moving the names whose hashes are in the upper part of
+// its range to a new block at the end of dp.  Returns -1 if
+// the index is full, the names' hashes are all equal, or the
+// disk is full.
+static int
+dxsplit(struct inode *dp, struct buf *bpi, int i)
+{
+  struct dxentry *dx;
+  struct dirent *de, *prev;
+  struct buf *bp, *nbp;
+  uint64 lo, hi, mid;
+  uint addr, bn, off, next;
+  int n, total, end;
+
+  dx = (struct dxentry*)(bpi->data + DXOFF);
+  end = dxend(dx);
+  if(end == NDXENTRY)
+    return -1;
+
+  // Halve the block's hash range until the
+  // midpoint falls between two of its names.
+  bp = bread(dp->dev, bmap(dp, dx[i].block));
+  lo = dx[i].hash;
+  hi = i+1 < end ? dx[i+1].hash : 0x100000000ULL;
+  for(;;){
+    if(hi - lo < 2){
+      brelse(bp);
+      return -1;
+    }
+    mid = lo + (hi - lo) / 2;
+    n = total = 0;
+    for(off = 0; off < BSIZE; off += de->reclen){
+      de = drec(bp->data, off);
+      if(de->inum == 0)
+        continue;
+      total++;
+      if(de->hash >= mid)
+        n++;
+    }
+    if(n == 0)
+      hi = mid;
+    else if(n == total)
+      lo = mid;
+    else
+      break;
+  }
+
+  bn = dp->size / BSIZE;
+  if((addr = bmap(dp, bn)) == 0){
+    brelse(bp);
+    return -1;
+  }
+  nbp = bread(dp->dev, addr);
+  dblkinit(nbp->data);
+  prev = 0;
+  for(off = 0; off < BSIZE; off = next){
+    de = drec(bp->data, off);
+    next = off + de->reclen;
+    if(de->inum == 0 || de->hash < mid){
+      prev = de;
+      continue;
+    }
+    if(dblkadd(nbp->data, de->name, de->namelen, de->hash, de->inum) < 0)
+      panic("dxsplit");
+    if(prev)
+      prev->reclen += de->reclen;
+    else {
+      de->inum = 0;
+      prev = de;
+    }
+  }
+  memmove(&dx[i+2], &dx[i+1], (end - (i+1)) * sizeof(*dx));
+  dx[i+1].hash = mid;
+  dx[i+1].block = bn;
+  log_write(nbp);
+  brelse(nbp);
+  log_write(bp);
+  brelse(bp);
+  log_write(bpi);
+  dp->size += BSIZE;
+  iupdate(dp);
+
+  // The moved names' cached offsets are stale.
+  dcachepurge(dp->dev, dp->inum);
+  return 0;
+}
+
+// Add (name, inum) to hashed directory dp, which does not
+// hold name.  Returns the entry's offset, or -1.
+static int
+dxlink(struct inode *dp, char *name, uint inum)
+{
+  struct buf *bpi, *bp;
+  struct dxentry *dx;
+  struct dirent *de;
+  uint bn, addr, h;
+  int i, len, off;
+
+  if(dp->size == 0){
+    // New directory: an index block holding "." and ".."
+    // entries and one index entry, for block 1.
+    if((addr = bmap(dp, 0)) == 0 || bmap(dp, 1) == 0)
+      return -1;
+    bpi = bread(dp->dev, addr);
+    memset(bpi->data, 0, BSIZE);
+    for(i = 0; i < 2; i++){
+      de = (struct dirent*)(bpi->data + 16*i);
+      de->reclen = 16;
+      de->namelen = i + 1;
+      de->hash = dirhash("..", i + 1);
+      memmove(de->name, "..", i + 1);
+    }
+    ((struct dirent*)(bpi->data + 32))->reclen = BSIZE - 32;
+    dx = (struct dxentry*)(bpi->data + DXOFF);
+    dx[0].hash = 0;
+    dx[0].block = 1;
+    log_write(bpi);
+    brelse(bpi);
+    bp = bread(dp->dev, bmap(dp, 1));
+    dblkinit(bp->data);
+    log_write(bp);
+    brelse(bp);
+    dp->size = 2*BSIZE;
+    iupdate(dp);
+  }
+
+  bpi = bread(dp->dev, bmap(dp, 0));
+  if(namecmp(name, ".") == 0 || namecmp(name, "..") == 0){
+    off = 16 * (name[1] == '.');
+    ((struct dirent*)(bpi->data + off))->inum = inum;
+    log_write(bpi);
+    brelse(bpi);
+    return off;
+  }
+
+  len = strlen(name);
+  h = dirhash(name, len);
+  for(;;){
+    dx = (struct dxentry*)(bpi->data + DXOFF);
+    i = dxfind(dx, h);
+    bn = dx[i].block;
+    bp = bread(dp->dev, bmap(dp, bn));
+    if((off = dblkadd(bp->data, name, len, h, inum)) >= 0){
+      log_write(bp);
+      brelse(bp);
+      brelse(bpi);
+      return bn*BSIZE + off;
+    }
+    brelse(bp);
+    if(dxsplit(dp, bpi, i) < 0){
+      brelse(bpi);
+      return -1;
+    }
+  }
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 // Caller must have already locked dp.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
-  uint off, inum;
+  uint off, inum, h;
   struct buf *bp;
-  struct dirent *de;
+  struct dentry *e;
+  int len, o;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
+  acquire(&dcache.lock);
+  if((e = dfind(dp->dev, dp->inum, name)) != 0){
+    dcache.hit++;
+    inum = e->inum;
+    off = e->off;
+    if(inum == 0)
+      dcache.neghit++;
+    release(&dcache.lock);
+    if(inum == 0)
+      return 0;
+    if(poff)
+      *poff = off;
+    return iget(dp->dev, inum);
+  }
+  dcache.miss++;
+  release(&dcache.lock);
+
+  if(dp->layout & L_HASHED){
+    if((inum = dxlookup(dp, name, &off)) == 0){
+      dcacheset(dp, name, 0, 0);
+      return 0;
+    }
+    if(poff)
+      *poff = off;
+    dcacheset(dp, name, inum, off);
+    return iget(dp->dev, inum);
+  }
+
+  len = strlen(name);
+  h = dirhash(name, len);
   for(off = 0; off < dp->size; off += BSIZE){
     bp = bread(dp->dev, bmap(dp, off / BSIZE));
-    for(de = (struct dirent*)bp->data;
-        de < (struct dirent*)(bp->data + BSIZE);
-        de++){
-      if(de->inum == 0)
-        continue;
-      if(namecmp(name, de->name) == 0){
-        // entry matches path element
-        if(poff)
-          *poff = off + (uchar*)de - bp->data;
-        inum = de->inum;
-        brelse(bp);
-        return iget(dp->dev, inum);
-      }
+    if((o = dblkfind(bp->data, name, len, h)) >= 0){
+      // entry matches path element
+      off += o;
+      if(poff)
+        *poff = off;
+      inum = ((struct dirent*)(bp->data + o))->inum;
+      brelse(bp);
+      dcacheset(dp, name, inum, off);
+      return iget(dp->dev, inum);
     }
     brelse(bp);
   }
+  dcacheset(dp, name, 0, 0);
   return 0;
 }
 
@@ -496,9 +1790,14 @@ dirlookup(struct inode *dp, char *name, uint *poff)
 int
 dirlink(struct inode *dp, char *name, uint inum)
 {
-  int off;
-  struct dirent de;
+  uint off, addr, h;
+  struct buf *bp;
   struct inode *ip;
+  int len, o;
+
+  len = strlen(name);
+  if(len == 0 || len > DIRSIZ)
+    return -1;
 
   // Check that name is not present.
   if((ip = dirlookup(dp, name, 0)) != 0){
@@ -506,25 +1805,77 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
-  // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if(de.inum == 0)
-      break;
+  if(dp->layout & L_HASHED){
+    if((o = dxlink(dp, name, inum)) < 0)
+      return -1;
+    dcacheset(dp, name, inum, o);
+    return 0;
   }
 
-  strncpy(de.name, name, DIRSIZ);
-  de.inum = inum;
-  if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-    panic("dirlink");
-  
+  // Look for a block with room, else add one.
+  h = dirhash(name, len);
+  for(off = 0; off < dp->size; off += BSIZE){
+    bp = bread(dp->dev, bmap(dp, off / BSIZE));
+    if((o = dblkadd(bp->data, name, len, h, inum)) >= 0)
+      goto found;
+    brelse(bp);
+  }
+  if((addr = bmap(dp, off / BSIZE)) == 0)
+    return -1;  // disk full
+  bp = bread(dp->dev, addr);
+  dblkinit(bp->data);
+  o = dblkadd(bp->data, name, len, h, inum);
+  dp->size += BSIZE;
+  iupdate(dp);
+
+found:
+  log_write(bp);
+  brelse(bp);
+  dcacheset(dp, name, inum, off + o);
   return 0;
 }
 
+// Remove the entry for name, at offset off, from directory dp.
+// Caller must have locked dp.
+void
+dirunlink(struct inode *dp, char *name, uint off)
+{
+  struct buf *bp;
+
+  bp = bread(dp->dev, bmap(dp, off / BSIZE));
+  dblkdel(bp->data, off % BSIZE);
+  log_write(bp);
+  brelse(bp);
+  dcacheset(dp, name, 0, 0);
+}
+
+// Is the directory dp empty except for "." and ".." ?
+int
+isdirempty(struct inode *dp)
+{
+  struct buf *bp;
+  struct dirent *de;
+  uint off, o;
+
+  for(off = 0; off < dp->size; off += BSIZE){
+    bp = bread(dp->dev, bmap(dp, off / BSIZE));
+    for(o = 0; o < BSIZE; o += de->reclen){
+      de = drec(bp->data, o);
+      if(de->inum != 0 && !(de->namelen == 1 && de->name[0] == '.') &&
+         !(de->namelen == 2 && de->name[0] == '.' && de->name[1] == '.')){
+        brelse(bp);
+        return 0;
+      }
+    }
+    brelse(bp);
+  }
+  return 1;
+}
+
 // Paths
 
-// Copy the next path element from path into name.
+// Copy the next path element from path into name, or set
+// name to "" if the element is longer than DIRSIZ.
 // Return a pointer to the element following the copied one.
 // The returned path has no leading slashes,
 // so the caller can check *path=='\0' to see if the name is the last one.
@@ -550,12 +1901,10 @@ skipelem(char *path, char *name)
   while(*path != '/' && *path != 0)
     path++;
   len = path - s;
-  if(len >= DIRSIZ)
-    memmove(name, s, DIRSIZ);
-  else {
-    memmove(name, s, len);
-    name[len] = 0;
-  }
+  if(len > DIRSIZ)
+    len = 0;
+  memmove(name, s, len);
+  name[len] = 0;
   while(*path == '/')
     path++;
   return path;
@@ -563,7 +1912,7 @@ skipelem(char *path, char *name)
 
 // Look up and return the inode for a path name.
 // If parent != 0, return the inode for the parent and copy the final
-// path element into name, which must have room for DIRSIZ bytes.
+// path element into name, which must have room for DIRSIZ+1 bytes.
 static struct inode*
 namex(char *path, int nameiparent, char *name)
 {
@@ -575,6 +1924,10 @@ namex(char *path, int nameiparent, char *name)
     ip = idup(proc->cwd);
 
   while((path = skipelem(path, name)) != 0){
+    if(*name == 0){  // name too long
+      iput(ip);
+      return 0;
+    }
     ilock(ip);
     if(ip->type != T_DIR){
       iunlockput(ip);
@@ -602,7 +1955,7 @@ namex(char *path, int nameiparent, char *name)
 struct inode*
 namei(char *path)
 {
-  char name[DIRSIZ];
+  char name[DIRSIZ+1];
   return namex(path, 0, name);
 }
 
@@ -4,20 +4,39 @@
 // Block 0 is unused.
 // Block 1 is super block.
 // Inodes start at block 2.
+// The bitmap follows the inodes, and the log the bitmap.
 
 #define ROOTINO 1  // root i-number
-#define BSIZE 512  // block size
+#define BSIZE 4096 // block size
+#define SECTSIZE 512  // disk sector size
 
 // File system super block
 struct superblock {
   uint size;         // Size of file system image (blocks)
   uint nblocks;      // Number of data blocks
   uint ninodes;      // Number of inodes.
+  uint bsize;        // Block size: must be BSIZE
+  uint layout;       // Layout flags for new files
+  uint logstart;     // Block number of the log header
+  uint nlog;         // Number of log blocks, counting the header
 };
 
-#define NDIRECT 12
+// Inode layout flags.
+#define L_EXTENTS 0x1  // addrs holds extents, not block addresses
+#define L_HASHED  0x2  // Directory with a hash index (see below)
+#define L_INLINE  0x4  // File whose data is in the inode
+
+#define NDIRECT 9
+#define NLEVEL 3   // single, double and triple indirect blocks
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define NTINDIRECT (NDINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT + NTINDIRECT)
+
+// An L_INLINE file keeps up to NINLINE bytes of data in place
+// of its block addresses.  Written past that, it moves to
+// blocks and loses L_INLINE.
+#define NINLINE 112
 
 // On-disk inode structure
 struct dinode {
@@ -26,9 +45,27 @@ struct dinode {
   short minor;          // Minor device number (T_DEV only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint layout;          // L_EXTENTS, L_HASHED, L_INLINE
+  union {
+    uint addrs[NDIRECT+NLEVEL];   // Data block addresses, or extents
+    char data[NINLINE];           // L_INLINE: the data
+  };
 };
 
+// An extent: len blocks starting at disk block start.
+// An extent-mapped inode keeps NEXTENT extents in addrs,
+// followed by the address of an extent block holding
+// NXEXTENT more.  The extents list the file's blocks in
+// order; unused ones have len 0.
+struct extent {
+  uint start;
+  uint len;
+};
+
+#define NEXTENT  5
+#define XBLOCK   (2*NEXTENT)   // Index in addrs of the extent block
+#define NXEXTENT (BSIZE / sizeof(struct extent))
+
 // Inodes per block.
 #define IPB           (BSIZE / sizeof(struct dinode))
 
@@ -41,11 +78,41 @@ struct dinode {
 // Block containing bit for block b
 #define BBLOCK(b, ninodes) (b/BPB + (ninodes)/IPB + 3)
 
-// Directory is a file containing a sequence of dirent structures.
-#define DIRSIZ 14
+// Directory is a file containing blocks of variable-length
+// entries.  The entries of a block are chained by reclen, the
+// last reaching the end of the block; an entry with inum 0 is
+// free.  Each entry stores a hash of its name, so that a search
+// compares names only when the hashes match.  A directory's
+// size is always a multiple of BSIZE.
+#define DIRSIZ 255
 
 struct dirent {
   ushort inum;
-  char name[DIRSIZ];
+  ushort reclen;        // Bytes to the next entry
+  ushort namelen;
+  ushort pad;
+  uint hash;            // dirhash of the name
+  char name[DIRSIZ+1];  // namelen bytes on disk, not NUL-terminated
 };
 
+// Bytes in a dirent before the name.
+#define DIRHDR        12
+
+// Bytes the entry for an n-byte name needs.
+#define DIRREC(n)     ((DIRHDR + (n) + 3) & ~3)
+
+// A hashed directory starts with an index block: the "." and
+// ".." entries, a free entry spanning the rest of the block,
+// and, inside that, from DXOFF on, the index entries.
+// Each names a later block of the directory and the least hash
+// of the names that block holds; the entries in use are sorted
+// by hash, the first has hash 0, and unused ones have block 0.
+// A full block is split in two by hash, adding an entry.
+struct dxentry {
+  uint hash;
+  uint block;
+};
+
+#define DXOFF    48     // Offset of the index in the index block
+#define NDXENTRY ((BSIZE - DXOFF) / sizeof(struct dxentry))
+
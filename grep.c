@@ -21,7 +21,7 @@ grep(char *pattern, int fd)
       *q = 0;
       if(match(pattern, p)){
         *q = '\n';
-        write(1, p, q+1 - p);
+        fdwrite(1, p, q+1 - p);
       }
       p = q+1;
     }
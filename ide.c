@@ -1,4 +1,5 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// IDE driver code: bus-master DMA for the primary channel
+// when the PCI IDE controller supports it, PIO otherwise.
 
 #include "types.h"
 #include "defs.h"
@@ -8,6 +9,8 @@
 #include "x86.h"
 #include "traps.h"
 #include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
 #include "buf.h"
 
 #define IDE_BSY       0x80
@@ -17,16 +20,86 @@
 
 #define IDE_CMD_READ  0x20
 #define IDE_CMD_WRITE 0x30
+#define IDE_CMD_RDMUL 0xc4
+#define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_SETMUL 0xc6
+#define IDE_CMD_RDDMA 0xc8
+#define IDE_CMD_WRDMA 0xca
 
-// idequeue points to the buf now being read/written to the disk.
-// idequeue->qnext points to the next buf to be processed.
-// You must hold idelock while manipulating queue.
+// Bus-master IDE registers, at idedma.
+#define BM_CMD        0     // Command
+#define BM_STATUS     2     // Status
+#define BM_PRDT       4     // Physical address of PRD table
+#define BM_CMD_START  0x01
+#define BM_CMD_READ   0x08  // Transfer from the disk to memory
+#define BM_ST_ACTIVE  0x01
+#define BM_ST_ERR     0x02
+#define BM_ST_IRQ     0x04
+
+#define SPB (BSIZE/SECTSIZE)  // Sectors per block
+#define MAXMULTI 16   // Most sectors to move per interrupt
+#define RDEADLINE 50  // Ticks a read may wait before it goes first
+#define NPRD 16       // Most blocks to move per DMA command
+
+// idequeue points to the bufs now being read/written to the disk,
+// idenrun of them, for consecutive blocks, linked through qnext.
+// idepend holds the requests waiting their turn, sorted by
+// disk and block.  You must hold idelock while manipulating
+// either queue.  A block is SPB sectors on the disk.
+//
+// Requests are served in C-LOOK order: the disk sweeps up
+// through idepend from where the last command ended, then
+// jumps back to the lowest request and sweeps again.  A read
+// that has waited RDEADLINE ticks is served next wherever it
+// is, so a stream of requests ahead of the sweep cannot starve
+// it.  Each command takes the chosen request and the pending
+// ones for the blocks after it as one command: a DMA command
+// of up to NPRD blocks, or a READ or WRITE MULTIPLE command
+// that moves idemulti sectors per interrupt.  A PIO command
+// takes as many blocks as fit in one interrupt's worth, but
+// at least one, so with a disk that refuses READ MULTIPLE
+// it may take several interrupts.
 
 static struct spinlock idelock;
 static struct buf *idequeue;
+static int idenrun;
+static struct buf *idepend;
+static int idedone;       // Sectors of the command moved so far
+static uint idepos;       // Disk and block the sweep has reached
+static int idemulti[2];   // Sectors per interrupt each disk can take
+static uint64 idet0;      // When the command on the disk started
+
+// Bus-master DMA.  The controller reads the physical address
+// and length of each buffer from the PRD table; the kernel is
+// mapped one-to-one, so a buf's data pointer is its address.
+// The table must not cross a 64K boundary: aligning it to its
+// size sees to that.
+struct prd {
+  uint addr;
+  ushort len;
+  ushort eot;   // 0x8000 marks the last entry
+};
+
+static ushort idedma;     // Bus-master I/O port, or 0 to use PIO
+static struct prd prdt[NPRD] __attribute__((aligned(NPRD*8)));
+
+// Per-disk statistics, for idedump.
+static struct {
+  uint nreq;      // Requests
+  uint npend;     // Requests now pending
+  uint depthsum;  // Sum of npend seen by each request
+  uint maxdepth;
+  uint ncmd;      // Commands
+  uint nsect;     // Sectors moved
+  uint kcycles;   // Time commands spent on the disk, in 1024-cycle units
+} idestat[2];
+
+// The swap disk (secondary channel) is polled, so its transfers
+// are serialized with a sleep-lock rather than with idelock.
+static struct sleeplock swaplock;
 
 static int havedisk1;
-static void idestart(struct buf*);
+static void idestart(void);
 
 // Wait for IDE disk to become ready.
 static int
@@ -41,12 +114,50 @@ idewait(int checkerr)
   return 0;
 }
 
+// Look for a PCI IDE controller that can do bus-master DMA
+// with its primary channel at the legacy ports, and turn
+// bus mastering on.  Returns its bus-master I/O port, or 0.
+static ushort
+idefinddma(void)
+{
+  uint bdf, bar;
+  int progif;
+
+  progif = pcifind(0x01, 0x01, &bdf);  // mass storage, IDE
+  if(progif < 0 || !(progif & 0x80) || (progif & 0x01))
+    return 0;
+  bar = pciread(bdf, 0x20);  // BAR4
+  if(!(bar & 1) || (bar & ~3) == 0)
+    return 0;
+  pciwrite(bdf, 0x04, pciread(bdf, 0x04) | 0x05);  // I/O space, bus master
+  return bar & 0xfffc;
+}
+
+// Ask disk d to move MAXMULTI sectors per interrupt in READ
+// and WRITE MULTIPLE commands.  Returns the number of sectors
+// per interrupt to expect from it: 1 if it refuses.
+static int
+idesetmulti(int d)
+{
+  int r;
+
+  outb(0x3f6, 2);  // no interrupt for this one
+  outb(0x1f2, MAXMULTI);
+  outb(0x1f6, 0xe0 | (d<<4));
+  outb(0x1f7, IDE_CMD_SETMUL);
+  r = idewait(1);
+  outb(0x1f6, 0xe0 | (0<<4));
+  outb(0x3f6, 0);
+  return r < 0 ? 1 : MAXMULTI;
+}
+
 void
 ideinit(void)
 {
   int i;
 
   initlock(&idelock, "ide");
+  initsleeplock(&swaplock, "swap disk");
   picenable(IRQ_IDE);
   ioapicenable(IRQ_IDE, ncpu - 1);
   idewait(0);
@@ -62,123 +173,333 @@ ideinit(void)
   
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
+
+  idemulti[0] = idesetmulti(0);
+  if(havedisk1)
+    idemulti[1] = idesetmulti(1);
+
+  idedma = idefinddma();
+  if(idedma)
+    outb(idedma + BM_STATUS, BM_ST_ERR|BM_ST_IRQ);
+  cprintf("ide: %s\n", idedma ? "bus-master DMA" : "PIO");
+}
+
+// Move the next interrupt's worth of sectors of the PIO
+// command on idequeue between the disk and the bufs.
+// Returns the number of sectors left to move after that.
+static int
+idepio(void)
+{
+  struct buf *b;
+  uchar *p;
+  int i, n;
+
+  n = idenrun*SPB - idedone;
+  if(n > idemulti[idequeue->dev&1])
+    n = idemulti[idequeue->dev&1];
+  b = idequeue;
+  for(i = idedone/SPB; i > 0; i--)
+    b = b->qnext;
+  for(i = 0; i < n; i++, idedone++){
+    if(i > 0 && idedone%SPB == 0)
+      b = b->qnext;
+    p = b->data + (idedone%SPB)*SECTSIZE;
+    if(b->flags & B_DIRTY)
+      outsl(0x1f0, p, SECTSIZE/4);
+    else
+      insl(0x1f0, p, SECTSIZE/4);
+  }
+  return idenrun*SPB - idedone;
 }
 
-// Start the request for b.  Caller must hold idelock.
+// Issue the command for the idenrun bufs on idequeue.
 static void
-idestart(struct buf *b)
+idecmd(void)
 {
-  if(b == 0)
-    panic("idestart");
+  struct buf *b, *q;
+  uint sector;
+  int i, dma;
+
+  b = idequeue;
+  sector = b->blockno * SPB;
+  idedone = 0;
+  dma = idedma != 0;
+  if(dma){
+    for(i = 0, q = b; q != 0; i++, q = q->qnext){
+      prdt[i].addr = (uint)q->data;
+      prdt[i].len = BSIZE;
+      prdt[i].eot = q->qnext ? 0 : 0x8000;
+    }
+    outl(idedma + BM_PRDT, (uint)prdt);
+    outb(idedma + BM_CMD, (b->flags & B_DIRTY) ? 0 : BM_CMD_READ);
+    outb(idedma + BM_STATUS, BM_ST_ERR|BM_ST_IRQ);
+  }
+  idet0 = rdtsc();
 
   idewait(0);
   outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, 1);  // number of sectors
-  outb(0x1f3, b->sector & 0xff);
-  outb(0x1f4, (b->sector >> 8) & 0xff);
-  outb(0x1f5, (b->sector >> 16) & 0xff);
-  outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((b->sector>>24)&0x0f));
-  if(b->flags & B_DIRTY){
-    outb(0x1f7, IDE_CMD_WRITE);
-    outsl(0x1f0, b->data, 512/4);
+  outb(0x1f2, idenrun*SPB);  // number of sectors
+  outb(0x1f3, sector & 0xff);
+  outb(0x1f4, (sector >> 8) & 0xff);
+  outb(0x1f5, (sector >> 16) & 0xff);
+  outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
+  if(dma){
+    outb(0x1f7, (b->flags & B_DIRTY) ? IDE_CMD_WRDMA : IDE_CMD_RDDMA);
+    outb(idedma + BM_CMD, inb(idedma + BM_CMD) | BM_CMD_START);
+  } else if(b->flags & B_DIRTY){
+    outb(0x1f7, idemulti[b->dev&1] > 1 ? IDE_CMD_WRMUL : IDE_CMD_WRITE);
+    idepio();
   } else {
-    outb(0x1f7, IDE_CMD_READ);
+    outb(0x1f7, idemulti[b->dev&1] > 1 ? IDE_CMD_RDMUL : IDE_CMD_READ);
   }
 }
 
+// Sort key for a request: the disk, then the block.
+static uint
+idekey(struct buf *b)
+{
+  return ((b->dev&1) << 28) | (b->blockno & 0x0fffffff);
+}
+
+// Choose the next command from idepend, move its bufs to
+// idequeue and start it.  Caller must hold idelock; the
+// disk must be idle.
+static void
+idestart(void)
+{
+  struct buf *b, *q, **pp, **bp;
+  int n, max;
+
+  if(idepend == 0)
+    panic("idestart");
+
+  // An overdue read goes first, the most overdue one if several.
+  bp = 0;
+  for(pp = &idepend; (q = *pp) != 0; pp = &q->qnext)
+    if(!(q->flags & B_DIRTY) && (int)(ticks - q->deadline) >= 0)
+      if(bp == 0 || (int)(q->deadline - (*bp)->deadline) < 0)
+        bp = pp;
+
+  // Otherwise, the next request up from idepos, or
+  // the lowest one if the sweep has passed them all.
+  if(bp == 0){
+    for(bp = &idepend; *bp != 0; bp = &(*bp)->qnext)
+      if(idekey(*bp) >= idepos)
+        break;
+    if(*bp == 0)
+      bp = &idepend;
+  }
+
+  // Take it and the requests for the blocks after it,
+  // which follow it in idepend, going the same way.
+  b = *bp;
+  max = idedma ? NPRD : idemulti[b->dev&1] / SPB;
+  if(max < 1)
+    max = 1;
+  pp = &b->qnext;
+  for(n = 1; n < max; n++){
+    q = *pp;
+    if(q == 0 || q->dev != b->dev || q->blockno != b->blockno + n ||
+       (q->flags & B_DIRTY) != (b->flags & B_DIRTY))
+      break;
+    pp = &q->qnext;
+  }
+  *bp = *pp;
+  *pp = 0;
+  idequeue = b;
+  idenrun = n;
+  idepos = idekey(b) + n;
+  idestat[b->dev&1].npend -= n;
+  idestat[b->dev&1].ncmd++;
+  idestat[b->dev&1].nsect += n*SPB;
+  idecmd();
+}
+
 // Interrupt handler.
 void
 ideintr(void)
 {
-  struct buf *b;
+  struct buf *b, *q, **pp, *async;
+  int r;
 
-  // Take first buffer off queue.
   acquire(&idelock);
   if((b = idequeue) == 0){
     release(&idelock);
     cprintf("Spurious IDE interrupt.\n");
     return;
   }
-  idequeue = b->qnext;
+  if(idedma){
+    // Stop the transfer.  If it failed, give up on DMA and
+    // put the command's bufs back on idepend, to be done again
+    // with PIO in commands no bigger than the disk can take.
+    outb(idedma + BM_CMD, inb(idedma + BM_CMD) & ~BM_CMD_START);
+    r = inb(idedma + BM_STATUS);
+    outb(idedma + BM_STATUS, BM_ST_ERR|BM_ST_IRQ);
+    if(idewait(1) < 0 || (r & BM_ST_ERR)){
+      cprintf("ide: DMA error, using PIO\n");
+      idedma = 0;
+      for(pp=&idepend; *pp && idekey(*pp) < idekey(b); pp=&(*pp)->qnext)
+        ;
+      for(q = b; q->qnext != 0; q = q->qnext)
+        ;
+      q->qnext = *pp;
+      *pp = b;
+      idestat[b->dev&1].npend += idenrun;
+      idequeue = 0;
+      idestart();
+      release(&idelock);
+      return;
+    }
+  } else if(idewait(1) >= 0){
+    // Move the data for a read, or the next chunk of a
+    // write, and wait for the next interrupt if there is more.
+    if(b->flags & B_DIRTY){
+      if(idedone < idenrun*SPB){
+        idepio();
+        release(&idelock);
+        return;
+      }
+    } else if(idepio() > 0){
+      release(&idelock);
+      return;
+    }
+  }
+  idestat[b->dev&1].kcycles += (rdtsc() - idet0) >> 10;
 
-  // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, 512/4);
-  
-  // Wake process waiting for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
-  wakeup(b);
+  // Take the command's buffers off the queue and wake
+  // the processes waiting for them.
+  async = 0;
+  while((b = idequeue) != 0){
+    idequeue = b->qnext;
+    b->flags |= B_VALID;
+    b->flags &= ~B_DIRTY;
+    if(b->flags & B_ASYNC){
+      b->qnext = async;
+      async = b;
+    } else
+      wakeup(b);
+  }
   
-  // Start disk on next buf in queue.
-  if(idequeue != 0)
-    idestart(idequeue);
+  // Start disk on next command.
+  if(idepend != 0)
+    idestart();
 
   release(&idelock);
+
+  // Nobody waits for asynchronous requests: release
+  // their buffers, without idelock held.
+  while((b = async) != 0){
+    async = b->qnext;
+    biodone(b);
+  }
 }
 
 // Sync buf with disk. 
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
+// If B_ASYNC is set, just queue the request: ideintr will
+// release the buffer when it is done.
 void
 iderw(struct buf *b)
 {
   struct buf **pp;
+  int async, d;
 
-  if(!(b->flags & B_BUSY))
-    panic("iderw: buf not busy");
+  if(!holdingsleep(&b->lock))
+    panic("iderw: buf not locked");
   if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
     panic("iderw: nothing to do");
   if(b->dev != 0 && !havedisk1)
     panic("idrw: ide disk 1 not present");
 
+  // After the request is queued b may be done and gone.
+  async = b->flags & B_ASYNC;
+  if(async)
+    disownsleep(&b->lock);
+
   acquire(&idelock);
 
-  // Append b to idequeue.
-  b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)
+  // Insert b into idepend in block order.
+  b->deadline = ticks + RDEADLINE;
+  for(pp=&idepend; *pp && idekey(*pp) <= idekey(b); pp=&(*pp)->qnext)
     ;
+  b->qnext = *pp;
   *pp = b;
+  d = b->dev&1;
+  idestat[d].nreq++;
+  idestat[d].npend++;
+  idestat[d].depthsum += idestat[d].npend;
+  if(idestat[d].npend > idestat[d].maxdepth)
+    idestat[d].maxdepth = idestat[d].npend;
   
   // Start disk if necessary.
-  if(idequeue == b)
-    idestart(b);
+  if(idequeue == 0)
+    idestart();
   
   // Wait for request to finish.
   // Assuming will not sleep too long: ignore proc->killed.
-  while((b->flags & (B_VALID|B_DIRTY)) != B_VALID)
+  while(!async && (b->flags & (B_VALID|B_DIRTY)) != B_VALID)
     sleep(b, &idelock);
 
   release(&idelock);
 }
 
+// Print disk statistics.  Runs when user types ^T on
+// console.  No lock, to avoid wedging a stuck machine.
+void
+idedump(void)
+{
+  int d;
+
+  for(d = 0; d < 2; d++){
+    if(idestat[d].nreq == 0)
+      continue;
+    cprintf("disk %d: %d requests, queue depth avg %d max %d\n", d,
+            idestat[d].nreq, idestat[d].depthsum / idestat[d].nreq,
+            idestat[d].maxdepth);
+    cprintf("disk %d: %d commands, %d sectors (up to %d per %s), "
+            "service avg %d kcycles\n", d, idestat[d].ncmd, idestat[d].nsect,
+            idedma ? NPRD*SPB : idemulti[d], idedma ? "command" : "interrupt",
+            idestat[d].kcycles / idestat[d].ncmd);
+  }
+}
+
 //Changes made by Anish 
 //Venk's code for swap ide driver
 
-int readswapblock(int blockid, char *c) {
-       acquire(&idelock);
+// Wait for the swap disk to become ready.
+// Give up the CPU between polls instead of spinning.
+static void
+swapwait(void)
+{
+  while((inb(0x177) & 0xC0) != 0x40)
+    yield();
+}
+
+void readswapblock(int blockid, char *c) {
+       acquiresleep(&swaplock);
        outb(0x172, 1);
        outb(0x173, blockid & 0xff);
        outb(0x174, (blockid >> 8) & 0xff);
        outb(0x175, (blockid >> 16) & 0xff);
        outb(0x176, ((blockid >> 24) & 0x0f) | 0xE0);
        outb(0x177, 0x20);
-       while((inb(0x177) & 0xC0) != 0x40);
+       swapwait();
        insl(0x170, c, 512/4);
-       release(&idelock);
+       releasesleep(&swaplock);
 }
 
-int writeswapblock(int blockid, char *c) {
-       acquire(&idelock);
+void writeswapblock(int blockid, char *c) {
+       acquiresleep(&swaplock);
        outb(0x172, 1);
        outb(0x173, blockid & 0xff);
        outb(0x174, (blockid >> 8) & 0xff);
        outb(0x175, (blockid >> 16) & 0xff);
        outb(0x176, ((blockid >> 24) & 0x0f) | 0xE0);
        outb(0x177, 0x30);
-       while((inb(0x177) & 0xC0) != 0x40);
+       swapwait();
        outsl(0x170, c, 512/4);
-       release(&idelock);
+       releasesleep(&swaplock);
 }
 
 
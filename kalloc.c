@@ -20,8 +20,33 @@ struct spinlock vmem_lock;
 struct {
   struct spinlock lock;
   struct run *freelist;
+  int nfree;  // pages on freelist
 } kmem;
 
+// Caches that hold memory they could give back (the buffer
+// cache) register a reclaim callback with kreclaimer.  When
+// the free list cannot satisfy a request, kalloc asks each
+// callback to free up to the given number of pages; callbacks
+// must not sleep and return how many pages they freed.
+#define NRECLAIM 4
+static int (*reclaimer[NRECLAIM])(int);
+static int nreclaimer;
+
+void
+kreclaimer(int (*fn)(int))
+{
+  if(nreclaimer == NRECLAIM)
+    panic("kreclaimer");
+  reclaimer[nreclaimer++] = fn;
+}
+
+// Number of free pages; a hint, as it may change at any time.
+int
+kfreecount(void)
+{
+  return kmem.nfree;
+}
+
 // Initialize free list of physical pages.
 // This code cheats by just considering one megabyte of
 // pages after end.  Real systems would determine the
@@ -57,6 +82,7 @@ kfree(char *v, int len)
   memset(v, 1, len);
 
   acquire(&kmem.lock);
+  kmem.nfree += len / PAGE;
   p = (struct run*)v;
   pend = (struct run*)(v + len);
   for(rp=&kmem.freelist; (r=*rp) != 0 && r <= pend; rp=&r->next){
@@ -87,18 +113,13 @@ kfree(char *v, int len)
   release(&kmem.lock);
 }
 
-// Allocate n bytes of physical memory.
-// Returns a kernel-segment pointer.
-// Returns 0 if the memory cannot be allocated.
-char*
-kalloc(int n)
+// Take n bytes off the free list, or return 0.
+static char*
+allocrun(int n)
 {
   char *p;
   struct run *r, **rp;
 
-  if(n % PAGE || n <= 0)
-    panic("kalloc");
-
   acquire(&kmem.lock);
   for(rp=&kmem.freelist; (r=*rp) != 0; rp=&r->next){
     if(r->len >= n){
@@ -106,11 +127,38 @@ kalloc(int n)
       p = (char*)r + r->len;
 	  if(r->len == 0)
 		  *rp = r->next;
+      kmem.nfree -= n / PAGE;
       release(&kmem.lock);
       return p;
     }
   }
   release(&kmem.lock);
+  return 0;
+}
+
+// Allocate n bytes of physical memory.
+// Returns a kernel-segment pointer.
+// Returns 0 if the memory cannot be allocated.
+char*
+kalloc(int n)
+{
+  char *p;
+  int i, try;
+
+  if(n % PAGE || n <= 0)
+    panic("kalloc");
+
+  // Short of memory, ask the reclaimers for n bytes' worth of
+  // pages; if what they free is not contiguous, ask them for
+  // everything they can spare.
+  for(try = 0; ; try++){
+    if((p = allocrun(n)) != 0)
+      return p;
+    if(try == 2 || nreclaimer == 0)
+      break;
+    for(i = 0; i < nreclaimer; i++)
+      reclaimer[i](try == 0 ? n / PAGE : 0x7fffffff);
+  }
 
   cprintf("kalloc: out of memory\n");
   return 0;
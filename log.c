@@ -0,0 +1,296 @@
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+#include "fs.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "buf.h"
+
+// Write-ahead logging of file system metadata, so that a
+// crash leaves the file system as it was after some commit.
+//
+// A system call that may change the file system brackets its
+// changes with begin_op and end_op, and writes each metadata
+// block it changes with log_write rather than bdwrite.
+// log_write records the block number and pins the buffer in the
+// cache, where later changes to the same block are absorbed.
+// Nothing reaches the disk until the transaction, which gathers
+// the changes of any number of system calls, commits.  That
+// happens when the log is getting full, at fsync, and each time
+// the flusher runs:
+//
+//   1. write back the dirty buffers, so that the file data
+//      the transaction's inodes point to is on disk first;
+//   2. copy the logged blocks into the log, after those of
+//      earlier commits, all queued at once so that the disk
+//      driver writes them in one burst;
+//   3. write the header, naming every block in the log:
+//      this is the commit point;
+//   4. unpin the buffers and mark them dirty, leaving the
+//      flusher to install them at their home locations.
+//
+// No operation is under way during a commit, so every cached
+// metadata block then holds committed contents.  Once the log
+// is half full, a commit ends by writing back every dirty buffer
+// and emptying the log.
+//
+// Recovery, when the file system is loaded, copies the blocks
+// the header names to their homes in log order, so the newest
+// copy of each wins, and empties the log.
+//
+// File data is not logged.  A block freed by the open
+// transaction is not reused until the transaction commits
+// (see balloc).  A freed block may still be in the log, which
+// is emptied only once half full, so until then every write to
+// it is logged, by bzero and by writei, so that recovery cannot
+// overwrite data written to it with the block's old contents.
+//
+// The log is LOGSIZE blocks, after the bitmap: the header block,
+// then the logged blocks.  The header fits in one sector, so
+// the disk writes it whole or not at all.
+
+struct logheader {
+  int n;
+  int block[LOGSIZE-1];
+};
+
+struct {
+  struct spinlock lock;
+  uint dev;
+  uint start;           // Header block
+  int size;             // Blocks, counting the header
+  int outstanding;      // Operations under way
+  int committing;       // In commit(), please wait
+  int wantcommit;       // Commit once outstanding reaches 0
+  uint ncommit;         // Commits so far
+  int n;                // Blocks the open transaction has logged
+  int block[LOGSIZE-1];
+  struct logheader lh;  // Committed blocks in the log on disk
+} log;
+
+static void recover(void);
+static void commit(void);
+
+// Set up the log of dev, replaying it if it holds committed
+// transactions.  Called when the file system is loaded.
+void
+initlog(uint dev, struct superblock *sb)
+{
+  if(sizeof(struct logheader) > SECTSIZE)
+    panic("initlog: too big a logheader");
+  if(sb->nlog < 2 || sb->nlog > LOGSIZE)
+    panic("initlog: no log");
+
+  initlock(&log.lock, "log");
+  log.dev = dev;
+  log.start = sb->logstart;
+  log.size = sb->nlog;
+  recover();
+}
+
+// Read the log header from disk into log.lh.
+static void
+readhead(void)
+{
+  struct buf *bp;
+
+  bp = bread(log.dev, log.start);
+  memmove(&log.lh, bp->data, sizeof(log.lh));
+  brelse(bp);
+}
+
+// Write log.lh to the header block.  This is the point
+// at which the blocks it names become part of the disk.
+static void
+writehead(void)
+{
+  struct buf *bp;
+
+  bp = bread(log.dev, log.start);
+  memmove(bp->data, &log.lh, sizeof(log.lh));
+  bwrite(bp);
+  brelse(bp);
+}
+
+// Copy committed blocks from the log to their home locations.
+static void
+recover(void)
+{
+  struct buf *from, *to;
+  int i;
+
+  readhead();
+  if(log.lh.n < 0 || log.lh.n > log.size - 1)
+    panic("recover: bad log header");
+  if(log.lh.n == 0)
+    return;
+  for(i = 0; i < log.lh.n; i++){
+    from = bread(log.dev, log.start + 1 + i);
+    to = bnew(log.dev, log.lh.block[i]);
+    memmove(to->data, from->data, BSIZE);
+    brelse(from);
+    brelse(to);
+  }
+  bsync(log.dev);
+  cprintf("log: recovered %d blocks\n", log.lh.n);
+  log.lh.n = 0;
+  writehead();
+}
+
+// Commit the open transaction.  Caller holds log.lock, and no
+// operation is under way.
+static void
+docommit(void)
+{
+  log.committing = 1;
+  log.wantcommit = 0;
+  release(&log.lock);
+  commit();
+  acquire(&log.lock);
+  log.committing = 0;
+  log.ncommit++;
+  wakeup(&log);
+}
+
+// Called at the start of each FS system call.  Waits while a
+// commit is under way, or while the log might not have room
+// for this operation's blocks too.
+void
+begin_op(void)
+{
+  acquire(&log.lock);
+  for(;;){
+    if(log.committing)
+      sleep(&log, &log.lock);
+    else if(log.wantcommit ||
+            log.lh.n + log.n + (log.outstanding+1)*MAXOPBLOCKS > log.size - 1){
+      // Commit first, here if no other operation
+      // is left to do it.
+      if(log.outstanding == 0)
+        docommit();
+      else {
+        log.wantcommit = 1;
+        sleep(&log, &log.lock);
+      }
+    } else {
+      log.outstanding++;
+      break;
+    }
+  }
+  release(&log.lock);
+}
+
+// Called at the end of each FS system call.
+// Commits if a commit is wanted and this was the last
+// outstanding operation; otherwise the open transaction
+// waits for more.
+void
+end_op(void)
+{
+  acquire(&log.lock);
+  if(log.outstanding < 1)
+    panic("end_op");
+  log.outstanding--;
+  if(log.outstanding == 0 && log.wantcommit)
+    docommit();
+  release(&log.lock);
+}
+
+// Commit the open transaction, if it has logged anything,
+// and wait for it to be on disk.  Call outside operations.
+void
+logsync(void)
+{
+  uint n;
+
+  acquire(&log.lock);
+  while(log.committing)
+    sleep(&log, &log.lock);
+  if(log.n > 0){
+    if(log.outstanding == 0)
+      docommit();
+    else {
+      log.wantcommit = 1;
+      n = log.ncommit;
+      while(log.ncommit == n)
+        sleep(&log, &log.lock);
+    }
+  }
+  release(&log.lock);
+}
+
+// Caller has modified b->data and is done with the buffer.
+// Record the block number in the open transaction and pin
+// the buffer.  Replaces bdwrite(); a typical use is:
+//   bp = bread(...)
+//   modify bp->data[]
+//   log_write(bp)
+//   brelse(bp)
+void
+log_write(struct buf *b)
+{
+  acquire(&log.lock);
+  if(log.outstanding < 1)
+    panic("log_write outside of op");
+  if(!(b->flags & B_LOGGED)){  // else absorbed
+    if(log.lh.n + log.n >= log.size - 1)
+      panic("log_write: too big a transaction");
+    log.block[log.n++] = b->blockno;
+    bpin(b);
+  }
+  release(&log.lock);
+}
+
+// Is block blockno in the log on disk, so that recovery
+// would write it?
+int
+inlog(uint blockno)
+{
+  int i, r;
+
+  r = 0;
+  acquire(&log.lock);
+  for(i = 0; i < log.lh.n; i++)
+    if(log.lh.block[i] == blockno)
+      r = 1;
+  release(&log.lock);
+  return r;
+}
+
+static void
+commit(void)
+{
+  struct buf *from, *to;
+  int i;
+
+  if(log.n > 0){
+    bsync(log.dev);
+    for(i = 0; i < log.n; i++){
+      to = bnew(log.dev, log.start + 1 + log.lh.n + i);
+      from = bread(log.dev, log.block[i]);
+      memmove(to->data, from->data, BSIZE);
+      brelse(from);
+      brelse(to);
+    }
+    bsync(log.dev);
+    for(i = 0; i < log.n; i++)
+      log.lh.block[log.lh.n + i] = log.block[i];
+    log.lh.n += log.n;
+    writehead();
+    for(i = 0; i < log.n; i++){
+      from = bread(log.dev, log.block[i]);
+      bunpin(from);
+      brelse(from);
+    }
+    log.n = 0;
+    bcommitted();
+  }
+  if(log.lh.n > (log.size - 1) / 2){
+    bsync(log.dev);
+    log.lh.n = 0;
+    writehead();
+  }
+}
@@ -3,10 +3,12 @@
 #include "user.h"
 #include "fs.h"
 
+#define NAMECOL 14  // Shorter names are padded to this width
+
 char*
 fmtname(char *path)
 {
-  static char buf[DIRSIZ+1];
+  static char buf[NAMECOL+1];
   char *p;
   
   // Find first character after last slash.
@@ -15,10 +17,10 @@ fmtname(char *path)
   p++;
   
   // Return blank-padded name.
-  if(strlen(p) >= DIRSIZ)
+  if(strlen(p) >= NAMECOL)
     return p;
   memmove(buf, p, strlen(p));
-  memset(buf+strlen(p), ' ', DIRSIZ-strlen(p));
+  memset(buf+strlen(p), ' ', NAMECOL-strlen(p));
   return buf;
 }
 
@@ -54,11 +56,8 @@ ls(char *path)
     strcpy(buf, path);
     p = buf+strlen(buf);
     *p++ = '/';
-    while(read(fd, &de, sizeof(de)) == sizeof(de)){
-      if(de.inum == 0)
-        continue;
-      memmove(p, de.name, DIRSIZ);
-      p[DIRSIZ] = 0;
+    while(readdir(fd, &de)){
+      strcpy(p, de.name);
       if(stat(buf, &st) < 0){
         printf(1, "ls: cannot stat %s\n", buf);
         continue;
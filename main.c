@@ -36,6 +36,7 @@ main(int memsize)
     timerinit();   // uniprocessor timer
   pageinit();	   // enable paging
   userinit();      // first user process
+  kthread("bflusher", bflusher);  // buffer cache write-back
   bootothers();    // start other processors
 
   // Finish setting up this processor in mpmain.
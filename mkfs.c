@@ -7,18 +7,21 @@
 #include "types.h"
 #include "fs.h"
 #include "stat.h"
+#include "param.h"
 
-int nblocks = 995;
+int nblocks = 8182 - LOGSIZE;
+int nlog = LOGSIZE;
 int ninodes = 200;
-int size = 1024;
+int size = 8192;
 
 int fsfd;
 struct superblock sb;
-char zeroes[512];
+char zeroes[BSIZE];
 uint freeblock;
 uint usedblocks;
 uint bitblocks;
 uint freeinode = 1;
+uint layout = 0;
 
 void balloc(int);
 void wsect(uint, void*);
@@ -27,6 +30,9 @@ void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+uint emap(struct dinode *din, uint fbn);
+void dirinit(char *blk);
+int dirput(char *blk, char *name, uint inum);
 
 // convert to intel byte order
 ushort
@@ -55,18 +61,31 @@ int
 main(int argc, char *argv[])
 {
   int i, cc, fd;
-  uint rootino, inum, off;
-  struct dirent de;
-  char buf[512];
-  struct dinode din;
-
+  uint rootino, inum;
+  char buf[BSIZE], dir[BSIZE], dxblk[BSIZE];
+  struct dirent *de;
+  struct dxentry *dx;
+
+  // -e: files use extents rather than block lists.
+  // -h: directories have hash indexes.
+  // -i: small files keep their data in the inode.
+  for(; argc > 1 && argv[1][0] == '-'; argc--, argv++){
+    if(strcmp(argv[1], "-e") == 0)
+      layout |= L_EXTENTS;
+    else if(strcmp(argv[1], "-h") == 0)
+      layout |= L_HASHED;
+    else if(strcmp(argv[1], "-i") == 0)
+      layout |= L_INLINE;
+    else
+      argc = 0;
+  }
   if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+    fprintf(stderr, "Usage: mkfs [-e] [-h] [-i] fs.img files...\n");
     exit(1);
   }
 
-  assert((512 % sizeof(struct dinode)) == 0);
-  assert((512 % sizeof(struct dirent)) == 0);
+  assert((BSIZE % sizeof(struct dinode)) == 0);
+  assert((BSIZE % SECTSIZE) == 0);
 
   fsfd = open(argv[1], O_RDWR|O_CREAT|O_TRUNC, 0666);
   if(fsfd < 0){
@@ -77,13 +96,18 @@ main(int argc, char *argv[])
   sb.size = xint(size);
   sb.nblocks = xint(nblocks); // so whole disk is size sectors
   sb.ninodes = xint(ninodes);
+  sb.bsize = xint(BSIZE);
+  sb.layout = xint(layout);
 
-  bitblocks = size/(512*8) + 1;
+  bitblocks = size/(BSIZE*8) + 1;
   usedblocks = ninodes / IPB + 3 + bitblocks;
+  sb.logstart = xint(usedblocks);
+  sb.nlog = xint(nlog);
+  usedblocks += nlog;
   freeblock = usedblocks;
 
-  printf("used %d (bit %d ninode %lu) free %u total %d\n", usedblocks,
-         bitblocks, ninodes/IPB + 1, freeblock, nblocks+usedblocks);
+  printf("used %d (bit %d ninode %lu log %d) free %u total %d\n", usedblocks,
+         bitblocks, ninodes/IPB + 1, nlog, freeblock, nblocks+usedblocks);
 
   assert(nblocks + usedblocks == size);
 
@@ -91,22 +115,33 @@ main(int argc, char *argv[])
     wsect(i, zeroes);
 
   // [vs] fix to avoid wsect() running over a page boundary
-  char tmp_buf[512] = {};
+  char tmp_buf[BSIZE] = {};
   memcpy(tmp_buf, &sb, sizeof(struct superblock));
   wsect(1, &tmp_buf);
 
   rootino = ialloc(T_DIR);
   assert(rootino == ROOTINO);
 
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, ".");
-  iappend(rootino, &de, sizeof(de));
-
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, "..");
-  iappend(rootino, &de, sizeof(de));
+  // The root directory is one block of entries, written
+  // once the files are in.
+  dirinit(dir);
+  if(layout & L_HASHED){
+    // Preceded by an index block holding . and .. and
+    // one index entry, for block 1.
+    bzero(dxblk, BSIZE);
+    for(i = 0; i < 3; i++){
+      de = (struct dirent*) (dxblk + 16*i);
+      de->reclen = xshort(i < 2 ? 16 : BSIZE - 32);
+    }
+    dirput(dxblk, ".", rootino);
+    dirput(dxblk, "..", rootino);
+    dx = (struct dxentry*) (dxblk + DXOFF);
+    dx[0].hash = xint(0);
+    dx[0].block = xint(1);
+  } else {
+    dirput(dir, ".", rootino);
+    dirput(dir, "..", rootino);
+  }
 
   for(i = 2; i < argc; i++){
     assert(index(argv[i], '/') == 0);
@@ -125,10 +160,10 @@ main(int argc, char *argv[])
 
     inum = ialloc(T_FILE);
 
-    bzero(&de, sizeof(de));
-    de.inum = xshort(inum);
-    strncpy(de.name, argv[i], DIRSIZ);
-    iappend(rootino, &de, sizeof(de));
+    if(dirput(dir, argv[i], inum) < 0){
+      fprintf(stderr, "mkfs: root directory full at %s\n", argv[i]);
+      exit(1);
+    }
 
     while((cc = read(fd, buf, sizeof(buf))) > 0)
       iappend(inum, buf, cc);
@@ -136,12 +171,9 @@ main(int argc, char *argv[])
     close(fd);
   }
 
-  // fix size of root inode dir
-  rinode(rootino, &din);
-  off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
-  winode(rootino, &din);
+  if(layout & L_HASHED)
+    iappend(rootino, dxblk, BSIZE);
+  iappend(rootino, dir, BSIZE);
 
   balloc(usedblocks);
 
@@ -151,11 +183,11 @@ main(int argc, char *argv[])
 void
 wsect(uint sec, void *buf)
 {
-  if(lseek(fsfd, sec * 512L, 0) != sec * 512L){
+  if(lseek(fsfd, sec * (long)BSIZE, 0) != sec * (long)BSIZE){
     perror("lseek");
     exit(1);
   }
-  if(write(fsfd, buf, 512) != 512){
+  if(write(fsfd, buf, BSIZE) != BSIZE){
     perror("write");
     exit(1);
   }
@@ -170,7 +202,7 @@ i2b(uint inum)
 void
 winode(uint inum, struct dinode *ip)
 {
-  char buf[512];
+  char buf[BSIZE];
   uint bn;
   struct dinode *dip;
 
@@ -184,7 +216,7 @@ winode(uint inum, struct dinode *ip)
 void
 rinode(uint inum, struct dinode *ip)
 {
-  char buf[512];
+  char buf[BSIZE];
   uint bn;
   struct dinode *dip;
 
@@ -197,11 +229,11 @@ rinode(uint inum, struct dinode *ip)
 void
 rsect(uint sec, void *buf)
 {
-  if(lseek(fsfd, sec * 512L, 0) != sec * 512L){
+  if(lseek(fsfd, sec * (long)BSIZE, 0) != sec * (long)BSIZE){
     perror("lseek");
     exit(1);
   }
-  if(read(fsfd, buf, 512) != 512){
+  if(read(fsfd, buf, BSIZE) != BSIZE){
     perror("read");
     exit(1);
   }
@@ -217,6 +249,7 @@ ialloc(ushort type)
   din.type = xshort(type);
   din.nlink = xshort(1);
   din.size = xint(0);
+  din.layout = xint(type == T_DIR ? layout & ~L_INLINE : layout & ~L_HASHED);
   winode(inum, &din);
   return inum;
 }
@@ -224,16 +257,16 @@ ialloc(ushort type)
 void
 balloc(int used)
 {
-  uchar buf[512];
+  uchar buf[BSIZE];
   int i;
 
   printf("balloc: first %d blocks have been allocated\n", used);
-  assert(used < 512*8);
-  bzero(buf, 512);
+  assert(used < BSIZE*8);
+  bzero(buf, BSIZE);
   for(i = 0; i < used; i++) {
     buf[i/8] = buf[i/8] | (0x1 << (i%8));
   }
-  printf("balloc: write bitmap block at sector %lu\n", ninodes/IPB + 3);
+  printf("balloc: write bitmap block at block %lu\n", ninodes/IPB + 3);
   wsect(ninodes / IPB + 3, buf);
 }
 
@@ -245,23 +278,42 @@ iappend(uint inum, void *xp, int n)
   char *p = (char*) xp;
   uint fbn, off, n1;
   struct dinode din;
-  char buf[512];
+  char buf[BSIZE];
   uint indirect[NINDIRECT];
   uint x;
 
   rinode(inum, &din);
 
   off = xint(din.size);
+  if(xint(din.layout) & L_INLINE){
+    if(off + n <= NINLINE){
+      bcopy(p, din.data + off, n);
+      din.size = xint(off + n);
+      winode(inum, &din);
+      return;
+    }
+    // Too big: move the data to blocks.
+    bcopy(din.data, buf, off);
+    bzero(din.data, NINLINE);
+    din.layout = xint(xint(din.layout) & ~L_INLINE);
+    din.size = xint(0);
+    winode(inum, &din);
+    if(off > 0)
+      iappend(inum, buf, off);
+    rinode(inum, &din);
+  }
   while(n > 0){
-    fbn = off / 512;
-    assert(fbn < MAXFILE);
-    if(fbn < NDIRECT) {
+    fbn = off / BSIZE;
+    if(xint(din.layout) & L_EXTENTS) {
+      x = emap(&din, fbn);
+    } else if(fbn < NDIRECT) {
       if(xint(din.addrs[fbn]) == 0) {
         din.addrs[fbn] = xint(freeblock++);
         usedblocks++;
       }
       x = xint(din.addrs[fbn]);
     } else {
+      assert(fbn < NDIRECT + NINDIRECT);  // no double-indirect blocks here
       if(xint(din.addrs[NDIRECT]) == 0) {
         // printf("allocate indirect block\n");
         din.addrs[NDIRECT] = xint(freeblock++);
@@ -276,9 +328,9 @@ iappend(uint inum, void *xp, int n)
       }
       x = xint(indirect[fbn-NDIRECT]);
     }
-    n1 = min(n, (fbn + 1) * 512 - off);
+    n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
-    bcopy(p, buf + off - (fbn * 512), n1);
+    bcopy(p, buf + off - (fbn * BSIZE), n1);
     wsect(x, buf);
     n -= n1;
     off += n1;
@@ -287,3 +339,88 @@ iappend(uint inum, void *xp, int n)
   din.size = xint(off);
   winode(inum, &din);
 }
+
+// Return the block holding block fbn of extent-mapped inode din,
+// allocating it if fbn is the block just past the end of the file.
+uint
+emap(struct dinode *din, uint fbn)
+{
+  struct extent *e;
+  uint off;
+  int i;
+
+  e = (struct extent*) din->addrs;
+  off = 0;
+  for(i = 0; i < NEXTENT && xint(e[i].len) > 0; i++){
+    if(fbn - off < xint(e[i].len))
+      return xint(e[i].start) + fbn - off;
+    off += xint(e[i].len);
+  }
+  assert(fbn == off);
+  usedblocks++;
+  if(i > 0 && xint(e[i-1].start) + xint(e[i-1].len) == freeblock){
+    e[i-1].len = xint(xint(e[i-1].len) + 1);
+  } else {
+    assert(i < NEXTENT);  // no extent block here
+    e[i].start = xint(freeblock);
+    e[i].len = xint(1);
+  }
+  return freeblock++;
+}
+
+// Same as dirhash in fs.c.
+uint
+dirhash(char *name, int len)
+{
+  uint h;
+  int i;
+
+  h = 2166136261U;  // FNV-1a
+  for(i = 0; i < len; i++){
+    h ^= (uchar)name[i];
+    h *= 16777619;
+  }
+  return h;
+}
+
+// Make blk an empty directory block: one free entry.
+void
+dirinit(char *blk)
+{
+  struct dirent *de;
+
+  bzero(blk, BSIZE);
+  de = (struct dirent*) blk;
+  de->reclen = xshort(BSIZE);
+}
+
+// Add (name, inum) to directory block blk, in the first
+// entry with room.  Returns the entry's offset, or -1.
+int
+dirput(char *blk, char *name, uint inum)
+{
+  struct dirent *de, *nde;
+  uint off, used, len;
+
+  len = strlen(name);
+  assert(len > 0 && len <= DIRSIZ);
+  for(off = 0; off < BSIZE; off += xshort(de->reclen)){
+    de = (struct dirent*) (blk + off);
+    used = xshort(de->inum) != 0 ? DIRREC(xshort(de->namelen)) : 0;
+    if(xshort(de->reclen) - used >= DIRREC(len)){
+      if(used > 0){
+        nde = (struct dirent*) (blk + off + used);
+        nde->reclen = xshort(xshort(de->reclen) - used);
+        de->reclen = xshort(used);
+        de = nde;
+        off += used;
+      }
+      de->inum = xshort(inum);
+      de->namelen = xshort(len);
+      de->hash = xint(dirhash(name, len));
+      memcpy(de->name, name, len);
+      return off;
+    }
+  }
+  return -1;
+}
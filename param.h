@@ -4,7 +4,11 @@
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NBUF         10  // size of disk block cache
+#define NIOV         16  // buffers per readv or writev
+#define NBUF         16  // minimum size of disk block cache
+#define BCACHEPCT    25  // maximum % of free memory for disk block cache
 #define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
+#define MAXOPBLOCKS  16  // max # of blocks any FS op writes
+#define LOGSIZE     128  // max data blocks in on-disk log, plus header
@@ -0,0 +1,61 @@
+// PCI configuration space, through configuration mechanism #1.
+// Just enough to find a device by class and reach its
+// configuration registers.
+
+#include "types.h"
+#include "defs.h"
+#include "x86.h"
+
+#define PCI_ADDR  0xcf8   // Configuration address port
+#define PCI_DATA  0xcfc   // Configuration data port
+
+#define PCI_ID     0x00   // Vendor and device ID
+#define PCI_CLASS  0x08   // Class, subclass, prog if, revision
+#define PCI_HDR    0x0c   // Header type in bits 16-23
+
+// A device's address: bus, device and function,
+// laid out as in PCI_ADDR.
+#define PCI_BDF(bus, dev, fn)  (((bus)<<16) | ((dev)<<11) | ((fn)<<8))
+
+// Read the 32-bit configuration register at offset off
+// of device bdf.
+uint
+pciread(uint bdf, int off)
+{
+  outl(PCI_ADDR, 0x80000000 | bdf | (off & 0xfc));
+  return inl(PCI_DATA);
+}
+
+void
+pciwrite(uint bdf, int off, uint v)
+{
+  outl(PCI_ADDR, 0x80000000 | bdf | (off & 0xfc));
+  outl(PCI_DATA, v);
+}
+
+// Find the first device of the given class and subclass
+// on bus 0.  Sets *bdf and returns the prog if byte,
+// or returns -1 if there is none.
+int
+pcifind(int class, int subclass, uint *bdf)
+{
+  int dev, fn, nfn;
+  uint a, c;
+
+  for(dev = 0; dev < 32; dev++){
+    nfn = 1;
+    for(fn = 0; fn < nfn; fn++){
+      a = PCI_BDF(0, dev, fn);
+      if((pciread(a, PCI_ID) & 0xffff) == 0xffff)
+        continue;
+      if(fn == 0 && (pciread(a, PCI_HDR) & 0x800000))
+        nfn = 8;  // multi-function device
+      c = pciread(a, PCI_CLASS);
+      if((c>>24) == class && ((c>>16) & 0xff) == subclass){
+        *bdf = a;
+        return (c>>8) & 0xff;
+      }
+    }
+  }
+  return -1;
+}
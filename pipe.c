@@ -4,8 +4,9 @@
 #include "mmu.h"
 #include "proc.h"
 #include "fs.h"
-#include "file.h"
 #include "spinlock.h"
+#include "sleeplock.h"
+#include "file.h"
 
 #define PIPESIZE 512
 
@@ -94,6 +95,46 @@ pipewrite(struct pipe *p, char *addr, int n)
   return n;
 }
 
+// Wait until p has room.  Returns the free bytes, or -1
+// if p has no reader or this process has been killed.
+int
+pipewait(struct pipe *p)
+{
+  int n;
+
+  acquire(&p->lock);
+  while(p->nwrite == p->nread + PIPESIZE){
+    if(p->readopen == 0 || proc->killed)
+      break;
+    wakeup(&p->nread);
+    sleep(&p->nwrite, &p->lock);
+  }
+  n = p->nread + PIPESIZE - p->nwrite;
+  if(p->readopen == 0 || proc->killed)
+    n = -1;
+  release(&p->lock);
+  return n;
+}
+
+// Copy as much of addr[0..n-1] into p as fits, without
+// waiting.  Returns the bytes copied, or -1 if p has no reader.
+int
+pipeput(struct pipe *p, char *addr, int n)
+{
+  int i;
+
+  acquire(&p->lock);
+  if(p->readopen == 0){
+    release(&p->lock);
+    return -1;
+  }
+  for(i = 0; i < n && p->nwrite != p->nread + PIPESIZE; i++)
+    p->data[p->nwrite++ % PIPESIZE] = addr[i];
+  wakeup(&p->nread);
+  release(&p->lock);
+  return i;
+}
+
 int
 piperead(struct pipe *p, char *addr, int n)
 {
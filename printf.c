@@ -1,15 +1,164 @@
 #include "types.h"
 #include "stat.h"
 #include "user.h"
+#include "fcntl.h"
+
+// Buffered output.  printf and fdwrite gather the output to
+// each fd in a buffer, written when it fills; if fd is a device,
+// such as the console, also at the end of a call that wrote a
+// newline.  Output to fd 2 is written at the end of each call.
+// Through flushhook (see ulib.c), close(fd) writes out fd's
+// buffer, and fork, exec and exit write out all of them.
+
+#define NOUT    16      // Buffered fds; as many as a process may open
+#define OUTBUF  512
+
+#define OB_NONE 1       // Write at the end of each call
+#define OB_LINE 2       // ... that wrote a newline
+#define OB_FULL 3       // Write only when full
+
+struct outbuf {
+  int mode;     // 0 until first used
+  int n;
+  int nl;       // Newline since the last write
+  char *buf;    // OUTBUF bytes
+};
+
+static struct outbuf out[NOUT];
+int outwrites;  // write() calls made, for benchmarks
+
+static void flushout(int);
+
+// The buffer for fd, set up at its first use,
+// or 0 if output to fd cannot be buffered.
+static struct outbuf*
+getbuf(int fd)
+{
+  struct outbuf *o;
+  struct stat st;
+
+  if(fd < 0 || fd >= NOUT)
+    return 0;
+  o = &out[fd];
+  if(o->mode == 0){
+    if(o->buf == 0 && (o->buf = malloc(OUTBUF)) == 0)
+      return 0;
+    if(fd == 2)
+      o->mode = OB_NONE;
+    else if(fstat(fd, &st) >= 0 && st.type == T_DEV)
+      o->mode = OB_LINE;
+    else
+      o->mode = OB_FULL;
+    o->n = 0;
+    o->nl = 0;
+    flushhook = flushout;
+  }
+  return o;
+}
+
+static void
+flush(int fd, struct outbuf *o)
+{
+  if(o->n > 0){
+    write(fd, o->buf, o->n);
+    outwrites++;
+  }
+  o->n = 0;
+  o->nl = 0;
+}
+
+// Add n bytes at p to fd's output.  If they do not fit,
+// write what is buffered, and with it p if p is big.
+static void
+put(int fd, struct outbuf *o, char *p, int n)
+{
+  struct iovec iov[2];
+  int i, nl;
+
+  if(o == 0){
+    write(fd, p, n);
+    outwrites++;
+    return;
+  }
+  nl = 0;
+  if(o->mode == OB_LINE)
+    for(i = 0; i < n && !nl; i++)
+      if(p[i] == '\n')
+        nl = 1;
+  if(o->n + n <= OUTBUF){
+    memmove(o->buf + o->n, p, n);
+    o->n += n;
+    o->nl |= nl;
+    return;
+  }
+  if(n < OUTBUF){
+    flush(fd, o);  // clears o->nl
+    memmove(o->buf, p, n);
+    o->n = n;
+    o->nl = nl;
+    return;
+  }
+  iov[0].base = o->buf;
+  iov[0].len = o->n;
+  iov[1].base = p;
+  iov[1].len = n;
+  writev(fd, iov, 2);
+  outwrites++;
+  o->n = 0;
+  o->nl = 0;
+}
+
+// End of a call writing to fd.
+static void
+done(int fd, struct outbuf *o)
+{
+  if(o && (o->mode == OB_NONE || o->nl))
+    flush(fd, o);
+}
+
+// Flush fd's buffer, or all of them if fd is -1.  Before
+// close(fd), also forget fd's mode, since the next file
+// opened as fd may be a different kind.
+static void
+flushout(int fd)
+{
+  int i;
+
+  for(i = 0; i < NOUT; i++)
+    if((fd == -1 || fd == i) && out[i].mode != 0)
+      flush(i, &out[i]);
+  if(fd >= 0 && fd < NOUT)
+    out[fd].mode = 0;
+}
+
+// Write n bytes at p to fd, through fd's buffer.
+int
+fdwrite(int fd, void *p, int n)
+{
+  struct outbuf *o;
+
+  o = getbuf(fd);
+  put(fd, o, p, n);
+  done(fd, o);
+  return n;
+}
+
+// Write out fd's buffer now.
+void
+fdflush(int fd)
+{
+  if(fd >= 0 && fd < NOUT && out[fd].mode != 0)
+    flush(fd, &out[fd]);
+}
 
 static void
-putc(int fd, char c)
+putc(int fd, struct outbuf *o, char c)
 {
-  write(fd, &c, 1);
+  put(fd, o, &c, 1);
 }
 
 static void
-printint(int fd, int xx, int base, int sgn)
+printint(int fd, struct outbuf *o, int xx, int base, int sgn)
 {
   static char digits[] = "0123456789ABCDEF";
   char buf[16];
@@ -24,25 +173,26 @@ printint(int fd, int xx, int base, int sgn)
     x = xx;
   }
 
-  i = 0;
+  i = sizeof(buf);
   do{
-    buf[i++] = digits[x % base];
+    buf[--i] = digits[x % base];
   }while((x /= base) != 0);
   if(neg)
-    buf[i++] = '-';
+    buf[--i] = '-';
 
-  while(--i >= 0)
-    putc(fd, buf[i]);
+  put(fd, o, buf + i, sizeof(buf) - i);
 }
 
 // Print to the given fd. Only understands %d, %x, %p, %s.
 void
 printf(int fd, char *fmt, ...)
 {
+  struct outbuf *o;
   char *s;
   int c, i, state;
   uint *ap;
 
+  o = getbuf(fd);
   state = 0;
   ap = (uint*)(void*)&fmt + 1;
   for(i = 0; fmt[i]; i++){
@@ -51,35 +201,33 @@ printf(int fd, char *fmt, ...)
       if(c == '%'){
         state = '%';
       } else {
-        putc(fd, c);
+        putc(fd, o, c);
       }
     } else if(state == '%'){
       if(c == 'd'){
-        printint(fd, *ap, 10, 1);
+        printint(fd, o, *ap, 10, 1);
         ap++;
       } else if(c == 'x' || c == 'p'){
-        printint(fd, *ap, 16, 0);
+        printint(fd, o, *ap, 16, 0);
         ap++;
       } else if(c == 's'){
         s = (char*)*ap;
         ap++;
         if(s == 0)
           s = "(null)";
-        while(*s != 0){
-          putc(fd, *s);
-          s++;
-        }
+        put(fd, o, s, strlen(s));
       } else if(c == 'c'){
-        putc(fd, *ap);
+        putc(fd, o, *ap);
         ap++;
       } else if(c == '%'){
-        putc(fd, c);
+        putc(fd, o, c);
       } else {
         // Unknown % sequence.  Print it to draw attention.
-        putc(fd, '%');
-        putc(fd, c);
+        putc(fd, o, '%');
+        putc(fd, o, c);
       }
       state = 0;
     }
   }
+  done(fd, o);
 }
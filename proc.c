@@ -183,6 +183,22 @@ userinit(void)
   p->state = RUNNABLE;
 }
 
+// Start a kernel thread running fn, which must not return.
+// The thread begins in forkret like any new process, but
+// forkret "returns" to fn rather than to trapret.
+void
+kthread(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    panic("kthread");
+  *(uint*)(p->context + 1) = (uint)fn;
+  p->parent = 0;
+  safestrcpy(p->name, name, sizeof(p->name));
+  p->state = RUNNABLE;
+}
+
 // Grow current process's memory by n bytes.
 // Return 0 on success, -1 on failure.
 int
@@ -328,9 +344,19 @@ yield(void)
 void
 forkret(void)
 {
+  static int first = 1;
+
   // Still holding ptable.lock from scheduler.
   release(&ptable.lock);
-  
+
+  if(first){
+    // The file system must be loaded, and its log replayed,
+    // in a process, which can sleep.  Any process that gets
+    // to the file system before this is done waits in getsb.
+    first = 0;
+    fsinit(ROOTDEV);
+  }
+
   // Return to "caller", actually trapret (see allocproc).
 }
 
@@ -435,7 +461,9 @@ exit(void)
     }
   }
 
+  begin_op();
   iput(proc->cwd);
+  end_op();
   proc->cwd = 0;
 
   acquire(&ptable.lock);
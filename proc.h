@@ -37,6 +37,7 @@ struct proc {
   struct trapframe *tf;        // Trap frame for current syscall
   struct context *context;     // Switch here to run process
   void *chan;                  // If non-zero, sleeping on chan
+  struct proc *lknext;         // Next waiter in a sleeplock's queue
   int killed;                  // If non-zero, have been killed
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
@@ -0,0 +1,87 @@
+// Sleeping locks, for resources held across disk I/O
+// (inodes, buffers).  A process that finds the lock held
+// joins the lock's wait queue and sleeps; releasesleep
+// passes ownership to the head of the queue and wakes only
+// that process, so waiters neither spin nor stampede.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "x86.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+
+void
+initsleeplock(struct sleeplock *lk, char *name)
+{
+  initlock(&lk->lk, "sleep lock");
+  lk->name = name;
+  lk->locked = 0;
+  lk->waitq = 0;
+  lk->pid = 0;
+}
+
+void
+acquiresleep(struct sleeplock *lk)
+{
+  struct proc **pp;
+
+  acquire(&lk->lk);
+  if(lk->locked){
+    // Join the end of the queue and wait to be handed the lock.
+    proc->lknext = 0;
+    for(pp = &lk->waitq; *pp; pp = &(*pp)->lknext)
+      ;
+    *pp = proc;
+    while(lk->pid != proc->pid)
+      sleep(&proc->lknext, &lk->lk);
+  } else {
+    lk->locked = 1;
+    lk->pid = proc->pid;
+  }
+  release(&lk->lk);
+}
+
+void
+releasesleep(struct sleeplock *lk)
+{
+  struct proc *p;
+
+  acquire(&lk->lk);
+  if((p = lk->waitq) != 0){
+    // Hand off: the lock stays locked, now owned by p.
+    lk->waitq = p->lknext;
+    lk->pid = p->pid;
+    wakeup(&p->lknext);
+  } else {
+    lk->locked = 0;
+    lk->pid = 0;
+  }
+  release(&lk->lk);
+}
+
+// Keep lk locked but owned by no process, for a lock that
+// an interrupt handler will release: a buffer under
+// asynchronous I/O.  Processes that then acquire it wait,
+// even the one that gave it up.
+void
+disownsleep(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  lk->pid = 0;
+  release(&lk->lk);
+}
+
+int
+holdingsleep(struct sleeplock *lk)
+{
+  int r;
+  
+  acquire(&lk->lk);
+  r = lk->locked && (lk->pid == proc->pid);
+  release(&lk->lk);
+  return r;
+}
+
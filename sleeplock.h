@@ -0,0 +1,13 @@
+// Long-term locks for processes.
+// Waiters sleep in a FIFO queue instead of spinning, and
+// releasesleep hands the lock directly to the first waiter.
+struct sleeplock {
+  uint locked;         // Is the lock held?
+  struct spinlock lk;  // Spinlock protecting this sleep lock.
+  struct proc *waitq;  // Processes waiting for the lock, oldest first.
+  
+  // For debugging:
+  char *name;          // Name of lock.
+  int pid;             // Process holding lock.
+};
+
@@ -8,12 +8,63 @@
 #include "proc.h"
 #include "spinlock.h"
 
+#define NLOCKSTAT 32
+
+// Statistics for each lock name.  Entries are never freed,
+// so locks in kalloc'ed memory (pipes) can point at them.
+// The last entry collects the names that did not fit.
+static struct {
+  uint busy;     // Guards adding entries; see lockstatfor.
+  int n;
+  struct lockstat stat[NLOCKSTAT];
+} locktab;
+
+// Add n to the 64-bit counter *p.  Both halves are updated
+// with locked instructions, and the carry of the first add
+// feeds the second, so concurrent updates are not lost.
+// A reader may see a torn value, which is fine for statistics.
+static void
+statadd(volatile uint64 *p, uint64 n)
+{
+  asm volatile("lock; addl %2, %0\n\tlock; adcl %3, %1" :
+               "+m" (((volatile uint*)p)[0]), "+m" (((volatile uint*)p)[1]) :
+               "r" ((uint)n), "r" ((uint)(n >> 32)) :
+               "cc");
+}
+
+// Find or create the statistics entry for name.
+static struct lockstat*
+lockstatfor(char *name)
+{
+  struct lockstat *s;
+
+  pushcli();
+  while(xchg(&locktab.busy, 1) != 0)
+    pause();
+  for(s = locktab.stat; s < locktab.stat + locktab.n; s++)
+    if(strncmp(s->name, name, 16) == 0)
+      goto out;
+  if(locktab.n == NLOCKSTAT)
+    s = &locktab.stat[NLOCKSTAT-1];
+  else {
+    locktab.n++;
+    s->name = locktab.n == NLOCKSTAT ? "(other)" : name;
+  }
+ out:
+  xchg(&locktab.busy, 0);
+  popcli();
+  return s;
+}
+
 void
 initlock(struct spinlock *lk, char *name)
 {
   lk->name = name;
   lk->locked = 0;
+  lk->next = 0;
+  lk->owner = 0;
   lk->cpu = 0;
+  lk->stat = lockstatfor(name);
 }
 
 // Acquire the lock.
@@ -23,17 +74,30 @@ initlock(struct spinlock *lk, char *name)
 void
 acquire(struct spinlock *lk)
 {
+  uint ticket;
+  uint64 t0;
+
   pushcli();
   if(holding(lk))
     panic("acquire");
 
-  // The xchg is atomic.
-  // It also serializes, so that reads after acquire are not
-  // reordered before it. 
-  while(xchg(&lk->locked, 1) != 0)
-    ;
+  // Take a ticket and wait until it is served.
+  // The xadd is atomic.  It also serializes, so that reads
+  // after acquire are not reordered before it.
+  // Waiters only read owner, so the cache line stays shared
+  // until the holder hands the lock on.
+  ticket = xaddl(&lk->next, 1);
+  if(lk->owner != ticket){
+    t0 = rdtsc();
+    while(lk->owner != ticket)
+      pause();
+    xaddl(&lk->stat->ncontend, 1);
+    statadd(&lk->stat->spin, rdtsc() - t0);
+  }
+  xaddl(&lk->stat->nacquire, 1);
 
   // Record info about lock acquisition for debugging.
+  lk->locked = 1;
   lk->cpu = cpu;
   getcallerpcs(&lk, lk->pcs);
 }
@@ -47,17 +111,19 @@ release(struct spinlock *lk)
 
   lk->pcs[0] = 0;
   lk->cpu = 0;
+  lk->locked = 0;
 
-  // The xchg serializes, so that reads before release are 
+  // Serve the next ticket.
+  // The xadd serializes, so that reads before release are 
   // not reordered after it.  The 1996 PentiumPro manual (Volume 3,
   // 7.2) says reads can be carried out speculatively and in
   // any order, which implies we need to serialize here.
   // But the 2007 Intel 64 Architecture Memory Ordering White
   // Paper says that Intel 64 and IA-32 will not move a load
-  // after a store. So lock->locked = 0 would work here.
-  // The xchg being asm volatile ensures gcc emits it after
+  // after a store. So lock->owner++ would work here.
+  // The xadd being asm volatile ensures gcc emits it after
   // the above assignments (and after the critical section).
-  xchg(&lk->locked, 0);
+  xaddl(&lk->owner, 1);
 
   popcli();
 }
@@ -88,6 +154,31 @@ holding(struct spinlock *lock)
 }
 
 
+// Print lock statistics to console.  For debugging.
+// Runs when user types ^L on console.
+// No lock to avoid wedging a stuck machine further.
+void
+lockdump(void)
+{
+  struct lockstat *s;
+  uint avg;
+
+  cprintf("lock acquire contend spin-kcycles avg-cycles\n");
+  for(s = locktab.stat; s < locktab.stat + locktab.n; s++){
+    // No 64-bit division in the kernel: work in kilocycles
+    // once the total no longer fits in 32 bits.
+    avg = 0;
+    if(s->ncontend > 0){
+      if((s->spin >> 32) == 0)
+        avg = (uint)s->spin / s->ncontend;
+      else
+        avg = (uint)(s->spin >> 10) / s->ncontend << 10;
+    }
+    cprintf("%s %d %d %d %d\n", s->name, s->nacquire, s->ncontend,
+            (uint)(s->spin >> 10), avg);
+  }
+}
+
 // Pushcli/popcli are like cli/sti except that they are matched:
 // it takes two popcli to undo two pushcli.  Also, if interrupts
 // are off, then pushcli, popcli leaves them off.
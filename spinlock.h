@@ -1,11 +1,26 @@
+// Lock statistics, shared by all locks with the same name
+// (for example, every pipe's lock counts toward "pipe").
+// Aligned so that two names never share a cache line.
+struct lockstat {
+  char *name;        // Name of the lock class.
+  uint nacquire;     // Number of acquisitions.
+  uint ncontend;     // Acquisitions that had to wait.
+  uint64 spin;       // Total cycles spent waiting (rdtsc).
+} __attribute__((aligned(64)));
+
 // Mutual exclusion lock.
+// A ticket lock: acquire takes the next ticket and waits for
+// owner to reach it, so CPUs get the lock in arrival order.
 struct spinlock {
   uint locked;       // Is the lock held?
+  volatile uint next;   // Next ticket to hand out.
+  volatile uint owner;  // Ticket now holding the lock.
   
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
   uint pcs[10];      // The call stack (an array of program counters)
                      // that locked the lock.
+  struct lockstat *stat;  // Contention statistics.
 };
 
@@ -8,4 +8,6 @@ struct stat {
   uint ino;    // Inode number on device
   short nlink; // Number of links to file
   uint size;   // Size of file in bytes
+  uint layout; // L_EXTENTS, L_HASHED, L_INLINE (see fs.h)
+  uint nextent; // Extents in use, if L_EXTENTS
 };
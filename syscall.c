@@ -93,6 +93,7 @@ extern int sys_exec(void);
 extern int sys_exit(void);
 extern int sys_fork(void);
 extern int sys_fstat(void);
+extern int sys_fsync(void);
 extern int sys_getpid(void);
 extern int sys_kill(void);
 extern int sys_link(void);
@@ -100,12 +101,18 @@ extern int sys_mkdir(void);
 extern int sys_mknod(void);
 extern int sys_open(void);
 extern int sys_pipe(void);
+extern int sys_pread(void);
+extern int sys_pwrite(void);
 extern int sys_read(void);
+extern int sys_readv(void);
 extern int sys_sbrk(void);
+extern int sys_sendfile(void);
 extern int sys_sleep(void);
 extern int sys_unlink(void);
+extern int sys_uptime(void);
 extern int sys_wait(void);
 extern int sys_write(void);
+extern int sys_writev(void);
 
 static int (*syscalls[])(void) = {
 [SYS_chdir]   sys_chdir,
@@ -115,6 +122,7 @@ static int (*syscalls[])(void) = {
 [SYS_exit]    sys_exit,
 [SYS_fork]    sys_fork,
 [SYS_fstat]   sys_fstat,
+[SYS_fsync]   sys_fsync,
 [SYS_getpid]  sys_getpid,
 [SYS_kill]    sys_kill,
 [SYS_link]    sys_link,
@@ -122,12 +130,18 @@ static int (*syscalls[])(void) = {
 [SYS_mknod]   sys_mknod,
 [SYS_open]    sys_open,
 [SYS_pipe]    sys_pipe,
+[SYS_pread]   sys_pread,
+[SYS_pwrite]  sys_pwrite,
 [SYS_read]    sys_read,
+[SYS_readv]   sys_readv,
 [SYS_sbrk]    sys_sbrk,
+[SYS_sendfile] sys_sendfile,
 [SYS_sleep]   sys_sleep,
 [SYS_unlink]  sys_unlink,
+[SYS_uptime]  sys_uptime,
 [SYS_wait]    sys_wait,
 [SYS_write]   sys_write,
+[SYS_writev]  sys_writev,
 };
 
 void
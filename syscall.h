@@ -19,3 +19,10 @@
 #define SYS_getpid 18
 #define SYS_sbrk   19
 #define SYS_sleep  20
+#define SYS_uptime 21
+#define SYS_fsync  22
+#define SYS_readv  23
+#define SYS_writev 24
+#define SYS_pread  25
+#define SYS_pwrite 26
+#define SYS_sendfile 27
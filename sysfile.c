@@ -5,6 +5,8 @@
 #include "mmu.h"
 #include "proc.h"
 #include "fs.h"
+#include "spinlock.h"
+#include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
 
@@ -82,6 +84,95 @@ sys_write(void)
   return filewrite(f, p, n);
 }
 
+// Fetch the nth system call argument as an array of n iovecs
+// and copy it to iov, checking the buffers and translating
+// their addresses to kernel ones.
+static int
+argiov(int n, int cnt, struct iovec *iov)
+{
+  struct iovec *uiov;
+  uint base, len;
+  int i;
+
+  if(cnt < 0 || cnt > NIOV || argptr(n, (char**)&uiov, cnt*sizeof(*uiov)) < 0)
+    return -1;
+  for(i = 0; i < cnt; i++){
+    base = (uint)uiov[i].base;
+    len = uiov[i].len;
+    if(len > 0x7fffffff || base >= proc->sz || base+len >= proc->sz)
+      return -1;
+    iov[i].base = proc->mem + base;
+    iov[i].len = len;
+  }
+  return 0;
+}
+
+int
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[NIOV];
+  int n;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argiov(1, n, iov) < 0)
+    return -1;
+  return filereadv(f, iov, n, -1);
+}
+
+int
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[NIOV];
+  int n;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argiov(1, n, iov) < 0)
+    return -1;
+  return filewritev(f, iov, n, -1);
+}
+
+// Read at a given offset, leaving the file offset alone.
+int
+sys_pread(void)
+{
+  struct file *f;
+  struct iovec iov;
+  int n, off;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, (char**)&iov.base, n) < 0 ||
+     argint(3, &off) < 0 || off < 0)
+    return -1;
+  iov.len = n;
+  return filereadv(f, &iov, 1, off);
+}
+
+// Write at a given offset, leaving the file offset alone.
+int
+sys_pwrite(void)
+{
+  struct file *f;
+  struct iovec iov;
+  int n, off;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, (char**)&iov.base, n) < 0 ||
+     argint(3, &off) < 0 || off < 0)
+    return -1;
+  iov.len = n;
+  return filewritev(f, &iov, 1, off);
+}
+
+// Copy up to n bytes from fd in to fd out in the kernel.
+int
+sys_sendfile(void)
+{
+  struct file *out, *in;
+  int n;
+
+  if(argfd(0, 0, &out) < 0 || argfd(1, 0, &in) < 0 || argint(2, &n) < 0)
+    return -1;
+  return filesend(out, in, n);
+}
+
 int
 sys_close(void)
 {
@@ -106,20 +197,35 @@ sys_fstat(void)
   return filestat(f, st);
 }
 
+int
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return filesync(f);
+}
+
 // Create the path new as a link to the same inode as old.
 int
 sys_link(void)
 {
-  char name[DIRSIZ], *new, *old;
+  char name[DIRSIZ+1], *new, *old;
   struct inode *dp, *ip;
 
   if(argstr(0, &old) < 0 || argstr(1, &new) < 0)
     return -1;
-  if((ip = namei(old)) == 0)
+
+  begin_op();
+  if((ip = namei(old)) == 0){
+    end_op();
     return -1;
+  }
   ilock(ip);
   if(ip->type == T_DIR){
     iunlockput(ip);
+    end_op();
     return -1;
   }
   ip->nlink++;
@@ -135,6 +241,7 @@ sys_link(void)
   }
   iunlockput(dp);
   iput(ip);
+  end_op();
   return 0;
 
 bad:
@@ -142,47 +249,37 @@ bad:
   ip->nlink--;
   iupdate(ip);
   iunlockput(ip);
+  end_op();
   return -1;
 }
 
-// Is the directory dp empty except for "." and ".." ?
-static int
-isdirempty(struct inode *dp)
-{
-  int off;
-  struct dirent de;
-
-  for(off=2*sizeof(de); off<dp->size; off+=sizeof(de)){
-    if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-      panic("isdirempty: readi");
-    if(de.inum != 0)
-      return 0;
-  }
-  return 1;
-}
-
 int
 sys_unlink(void)
 {
   struct inode *ip, *dp;
-  struct dirent de;
-  char name[DIRSIZ], *path;
+  char name[DIRSIZ+1], *path;
   uint off;
 
   if(argstr(0, &path) < 0)
     return -1;
-  if((dp = nameiparent(path, name)) == 0)
+
+  begin_op();
+  if((dp = nameiparent(path, name)) == 0){
+    end_op();
     return -1;
+  }
   ilock(dp);
 
   // Cannot unlink "." or "..".
   if(namecmp(name, ".") == 0 || namecmp(name, "..") == 0){
     iunlockput(dp);
+    end_op();
     return -1;
   }
 
   if((ip = dirlookup(dp, name, &off)) == 0){
     iunlockput(dp);
+    end_op();
     return -1;
   }
   ilock(ip);
@@ -192,12 +289,11 @@ sys_unlink(void)
   if(ip->type == T_DIR && !isdirempty(ip)){
     iunlockput(ip);
     iunlockput(dp);
+    end_op();
     return -1;
   }
 
-  memset(&de, 0, sizeof(de));
-  if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-    panic("unlink: writei");
+  dirunlink(dp, name, off);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -207,16 +303,25 @@ sys_unlink(void)
   ip->nlink--;
   iupdate(ip);
   iunlockput(ip);
+  end_op();
   return 0;
 }
 
+// Create path, of the given type, returning it locked, or
+// return the existing file if both are T_FILE.  Called within
+// an operation.  If the disk is full only because of blocks the
+// open transaction freed, ends the operation to commit them,
+// begins another, and tries once more.
 static struct inode*
 create(char *path, short type, short major, short minor)
 {
   uint off;
   struct inode *ip, *dp;
-  char name[DIRSIZ];
+  char name[DIRSIZ+1];
+  int retried;
 
+  retried = 0;
+retry:
   if((dp = nameiparent(path, name)) == 0)
     return 0;
   ilock(dp);
@@ -244,14 +349,32 @@ create(char *path, short type, short major, short minor)
     iupdate(dp);
     // No ip->nlink++ for ".": avoid cyclic ref count.
     if(dirlink(ip, ".", ip->inum) < 0 || dirlink(ip, "..", dp->inum) < 0)
-      panic("create dots");
+      goto full;
   }
 
   if(dirlink(dp, name, ip->inum) < 0)
-    panic("create: dirlink");
+    goto full;
 
   iunlockput(dp);
   return ip;
+
+full:
+  // Out of blocks: free ip again.
+  ip->nlink = 0;
+  iupdate(ip);
+  iunlockput(ip);
+  if(type == T_DIR){
+    dp->nlink--;
+    iupdate(dp);
+  }
+  iunlockput(dp);
+  if(retried || !bpending())
+    return 0;
+  retried = 1;
+  end_op();
+  logsync();
+  begin_op();
+  goto retry;
 }
 
 int
@@ -265,15 +388,21 @@ sys_open(void)
   if(argstr(0, &path) < 0 || argint(1, &omode) < 0)
     return -1;
 
+  begin_op();
   if(omode & O_CREATE){
-    if((ip = create(path, T_FILE, 0, 0)) == 0)
+    if((ip = create(path, T_FILE, 0, 0)) == 0){
+      end_op();
       return -1;
+    }
   } else {
-    if((ip = namei(path)) == 0)
+    if((ip = namei(path)) == 0){
+      end_op();
       return -1;
+    }
     ilock(ip);
     if(ip->type == T_DIR && omode != O_RDONLY){
       iunlockput(ip);
+      end_op();
       return -1;
     }
   }
@@ -282,9 +411,11 @@ sys_open(void)
     if(f)
       fileclose(f);
     iunlockput(ip);
+    end_op();
     return -1;
   }
   iunlock(ip);
+  end_op();
 
   f->type = FD_INODE;
   f->ip = ip;
@@ -301,9 +432,13 @@ sys_mkdir(void)
   char *path;
   struct inode *ip;
 
-  if(argstr(0, &path) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0)
+  begin_op();
+  if(argstr(0, &path) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
+    end_op();
     return -1;
+  }
   iunlockput(ip);
+  end_op();
   return 0;
 }
 
@@ -315,12 +450,16 @@ sys_mknod(void)
   int len;
   int major, minor;
   
+  begin_op();
   if((len=argstr(0, &path)) < 0 ||
      argint(1, &major) < 0 ||
      argint(2, &minor) < 0 ||
-     (ip = create(path, T_DEV, major, minor)) == 0)
+     (ip = create(path, T_DEV, major, minor)) == 0){
+    end_op();
     return -1;
+  }
   iunlockput(ip);
+  end_op();
   return 0;
 }
 
@@ -330,15 +469,20 @@ sys_chdir(void)
   char *path;
   struct inode *ip;
 
-  if(argstr(0, &path) < 0 || (ip = namei(path)) == 0)
+  begin_op();
+  if(argstr(0, &path) < 0 || (ip = namei(path)) == 0){
+    end_op();
     return -1;
+  }
   ilock(ip);
   if(ip->type != T_DIR){
     iunlockput(ip);
+    end_op();
     return -1;
   }
   iunlock(ip);
   iput(proc->cwd);
+  end_op();
   proc->cwd = ip;
   return 0;
 }
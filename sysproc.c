@@ -74,3 +74,16 @@ sys_sleep(void)
   release(&tickslock);
   return 0;
 }
+
+// Return how many clock tick interrupts have occurred
+// since boot.
+int
+sys_uptime(void)
+{
+  uint xticks;
+
+  acquire(&tickslock);
+  xticks = ticks;
+  release(&tickslock);
+  return xticks;
+}
@@ -2,8 +2,51 @@
 #include "stat.h"
 #include "fcntl.h"
 #include "user.h"
+#include "fs.h"
 #include "x86.h"
 
+int _fork(void);
+int _exit(void) __attribute__((noreturn));
+int _close(int);
+int _exec(char*, char**);
+
+// Set by printf.c once it buffers output.  Called with fd
+// before close(fd), and with -1 before fork, exec and exit,
+// so that buffered output is written once, and in order.
+void (*flushhook)(int);
+
+int
+fork(void)
+{
+  if(flushhook)
+    flushhook(-1);
+  return _fork();
+}
+
+int
+exit(void)
+{
+  if(flushhook)
+    flushhook(-1);
+  _exit();
+}
+
+int
+close(int fd)
+{
+  if(flushhook)
+    flushhook(fd);
+  return _close(fd);
+}
+
+int
+exec(char *path, char **argv)
+{
+  if(flushhook)
+    flushhook(-1);
+  return _exec(path, argv);
+}
+
 char*
 strcpy(char *s, char *t)
 {
@@ -103,3 +146,32 @@ memmove(void *vdst, void *vsrc, int n)
     *dst++ = *src++;
   return vdst;
 }
+
+// Read the next entry of the directory open as fd into *de,
+// with de->name NUL-terminated.  Returns 1, or 0 at the end.
+int
+readdir(int fd, struct dirent *de)
+{
+  char skip[512];
+  int n, m;
+
+  for(;;){
+    if(read(fd, de, DIRHDR) != DIRHDR || de->reclen < DIRHDR)
+      return 0;
+    n = de->reclen - DIRHDR;
+    if(de->inum != 0){
+      m = n < DIRSIZ ? n : DIRSIZ;
+      if(read(fd, de->name, m) != m)
+        return 0;
+      de->name[de->namelen] = 0;
+      n -= m;
+    }
+    for(; n > 0; n -= m){
+      m = n < sizeof(skip) ? n : sizeof(skip);
+      if(read(fd, skip, m) != m)
+        return 0;
+    }
+    if(de->inum != 0)
+      return 1;
+  }
+}
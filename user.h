@@ -1,4 +1,6 @@
 struct stat;
+struct dirent;
+struct iovec;
 
 // system calls
 int fork(void);
@@ -21,6 +23,13 @@ int dup(int);
 int getpid();
 char* sbrk(int);
 int sleep(int);
+int uptime(void);
+int fsync(int);
+int readv(int, struct iovec*, int);
+int writev(int, struct iovec*, int);
+int pread(int, void*, int, int);
+int pwrite(int, void*, int, int);
+int sendfile(int, int, int);
 
 // ulib.c
 int stat(char*, struct stat*);
@@ -28,10 +37,17 @@ char* strcpy(char*, char*);
 void *memmove(void*, void*, int);
 char* strchr(const char*, char c);
 int strcmp(const char*, const char*);
-void printf(int, char*, ...);
 char* gets(char*, int max);
 uint strlen(char*);
 void* memset(void*, int, uint);
 void* malloc(uint);
 void free(void*);
 int atoi(const char*);
+int readdir(int, struct dirent*);
+extern void (*flushhook)(int);
+
+// printf.c
+void printf(int, char*, ...);
+int fdwrite(int, void*, int);
+void fdflush(int);
+extern int outwrites;
@@ -80,6 +80,10 @@ writetest(void)
   printf(stdout, "small file test ok\n");
 }
 
+// 512-byte chunks for writetest1: enough to need
+// the single-indirect block.
+#define NBIG (NDIRECT + NINDIRECT)
+
 void
 writetest1(void)
 {
@@ -93,13 +97,17 @@ writetest1(void)
     exit();
   }
 
-  for(i = 0; i < MAXFILE; i++) {
+  for(i = 0; i < NBIG; i++) {
     ((int*) buf)[0] = i;
     if(write(fd, buf, 512) != 512) {
       printf(stdout, "error: write big file failed\n", i);
       exit();
     }
   }
+  if(fsync(fd) != 0) {
+    printf(stdout, "error: fsync big failed!\n");
+    exit();
+  }
 
   close(fd);
 
@@ -113,7 +121,7 @@ writetest1(void)
   for(;;) {
     i = read(fd, buf, 512);
     if(i == 0) {
-      if(n == MAXFILE - 1) {
+      if(n == NBIG - 1) {
         printf(stdout, "read only %d blocks from big", n);
         exit();
       }
@@ -656,10 +664,7 @@ concreate(void)
   char file[3];
   int i, pid, n, fd;
   char fa[40];
-  struct {
-    ushort inum;
-    char name[14];
-  } de;
+  struct dirent de;
 
   printf(1, "concreate test\n");
   file[0] = 'C';
@@ -689,9 +694,7 @@ concreate(void)
   memset(fa, 0, sizeof(fa));
   fd = open(".", 0);
   n = 0;
-  while(read(fd, &de, sizeof(de)) > 0){
-    if(de.inum == 0)
-      continue;
+  while(readdir(fd, &de)){
     if(de.name[0] == 'C' && de.name[2] == '\0'){
       i = de.name[1] - '0';
       if(i < 0 || i >= sizeof(fa)){
@@ -962,6 +965,56 @@ subdir(void)
   printf(1, "subdir ok\n");
 }
 
+// appends to two files in turn, so that on a file system
+// built with mkfs -e each block starts a new extent.  once a
+// file has used all its extents, writes to it must come up
+// short, not crash the kernel.
+#define XBLOCKS (NEXTENT + NXEXTENT + 100)
+
+void
+extentlimit(void)
+{
+  char *b;
+  int fd[2], n[2], i, r, full;
+
+  printf(1, "extent limit test\n");
+  b = malloc(BSIZE);
+  memset(b, 'x', BSIZE);
+  fd[0] = open("xa", O_CREATE | O_RDWR);
+  fd[1] = open("xb", O_CREATE | O_RDWR);
+  if(b == 0 || fd[0] < 0 || fd[1] < 0){
+    printf(1, "extentlimit: setup failed\n");
+    exit();
+  }
+  n[0] = n[1] = 0;
+  full = 0;
+  while(!full && n[1] < XBLOCKS){
+    for(i = 0; i < 2; i++){
+      if((r = write(fd[i], b, BSIZE)) != BSIZE){
+        if(r > BSIZE || n[i] < NEXTENT + NXEXTENT){
+          printf(1, "extentlimit: write %d of file %d returned %d\n", n[i], i, r);
+          exit();
+        }
+        full = 1;
+        break;
+      }
+      n[i]++;
+    }
+  }
+  if(full && write(fd[i], b, BSIZE) == BSIZE){
+    printf(1, "extentlimit: write after short write succeeded\n");
+    exit();
+  }
+  close(fd[0]);
+  close(fd[1]);
+  unlink("xa");
+  unlink("xb");
+  free(b);
+  if(full)
+    printf(1, "extent limit reached after %d blocks\n", n[i]);
+  printf(1, "extent limit ok\n");
+}
+
 void
 bigfile(void)
 {
@@ -1018,45 +1071,693 @@ bigfile(void)
   printf(1, "bigfile test ok\n");
 }
 
+// name is prefix followed by the four digits of i.
+void
+mkname(char *name, char *prefix, int i)
+{
+  int n;
+
+  n = strlen(prefix);
+  strcpy(name, prefix);
+  name[n] = '0' + i / 1000 % 10;
+  name[n+1] = '0' + i / 100 % 10;
+  name[n+2] = '0' + i / 10 % 10;
+  name[n+3] = '0' + i % 10;
+  name[n+4] = 0;
+}
+
+// write a file one block at a time.  on a file system built
+// with mkfs -e each block should go right after the one
+// before, growing the same extent, so that the whole file
+// needs only a few extents.
+#define XTBLOCKS 64
+
 void
-fourteen(void)
+extenttest(void)
+{
+  struct stat st;
+  char *b;
+  int fd, i;
+
+  printf(1, "extent test\n");
+  b = malloc(BSIZE);
+  memset(b, 'e', BSIZE);
+  fd = open("xfile", O_CREATE | O_RDWR);
+  if(b == 0 || fd < 0){
+    printf(1, "extenttest: setup failed\n");
+    exit();
+  }
+  // Commit blocks freed by earlier tests, which balloc
+  // does not hand out until then.
+  fsync(fd);
+  for(i = 0; i < XTBLOCKS; i++){
+    if(write(fd, b, BSIZE) != BSIZE){
+      printf(1, "extenttest: write %d failed\n", i);
+      exit();
+    }
+  }
+  if(fstat(fd, &st) < 0 || st.size != XTBLOCKS*BSIZE){
+    printf(1, "extenttest: xfile has the wrong size\n");
+    exit();
+  }
+  if((st.layout & L_EXTENTS) && (st.nextent == 0 || st.nextent > XTBLOCKS/16)){
+    printf(1, "extenttest: %d blocks took %d extents\n", XTBLOCKS, st.nextent);
+    exit();
+  }
+  close(fd);
+  unlink("xfile");
+  free(b);
+  printf(1, "extent test ok\n");
+}
+
+// many small appends to one file: each grows the file, but
+// the inode goes to the buffer cache only when it is synced.
+#define NAPPEND 4096
+
+void
+appendtest(void)
+{
+  int fd, i;
+  struct stat st;
+
+  printf(1, "append test\n");
+
+  fd = open("appfile", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf(1, "cannot create appfile\n");
+    exit();
+  }
+  for(i = 0; i < NAPPEND; i++){
+    if(write(fd, "0123456789abcdef", 16) != 16){
+      printf(1, "write appfile failed\n");
+      exit();
+    }
+  }
+  if(fsync(fd) != 0){
+    printf(1, "fsync appfile failed\n");
+    exit();
+  }
+  if(fstat(fd, &st) < 0 || st.size != NAPPEND*16){
+    printf(1, "appfile has wrong size\n");
+    exit();
+  }
+  close(fd);
+  unlink("appfile");
+
+  printf(1, "append test ok\n");
+}
+
+// write and read back a file big enough to need
+// the double-indirect block.
+#define BIGKB (8*1024)
+
+void
+hugefile(void)
+{
+  int fd, i;
+
+  printf(1, "huge file test\n");
+
+  fd = open("bigfile2", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf(1, "cannot create bigfile2\n");
+    exit();
+  }
+  for(i = 0; i < BIGKB; i++){
+    memset(buf, i, 1024);
+    ((int*)buf)[0] = i;
+    if(write(fd, buf, 1024) != 1024){
+      printf(1, "write bigfile2 failed at %d KB\n", i);
+      exit();
+    }
+  }
+  if(fsync(fd) != 0){
+    printf(1, "fsync bigfile2 failed\n");
+    exit();
+  }
+  close(fd);
+
+  fd = open("bigfile2", 0);
+  if(fd < 0){
+    printf(1, "cannot open bigfile2\n");
+    exit();
+  }
+  for(i = 0; i < BIGKB; i++){
+    if(read(fd, buf, 1024) != 1024 || ((int*)buf)[0] != i ||
+       buf[1023] != (char)i){
+      printf(1, "read bigfile2 failed at %d KB\n", i);
+      exit();
+    }
+  }
+  if(read(fd, buf, 1024) != 0){
+    printf(1, "bigfile2 too long\n");
+    exit();
+  }
+  close(fd);
+  if(unlink("bigfile2") < 0){
+    printf(1, "unlink bigfile2 failed\n");
+    exit();
+  }
+
+  printf(1, "huge file test ok\n");
+}
+
+// write fillfile until the disk is full; return the number
+// of 2048-byte chunks written.
+int
+fill(void)
+{
+  int fd, n;
+
+  fd = open("fillfile", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf(1, "cannot create fillfile\n");
+    exit();
+  }
+  memset(buf, 'f', 2048);
+  for(n = 0; write(fd, buf, 2048) == 2048; n++)
+    ;
+  close(fd);
+  return n;
+}
+
+// fill the disk twice: unlink should free all the space.
+void
+filltest(void)
+{
+  int n, n2;
+
+  printf(1, "disk fill test\n");
+
+  n = fill();
+  if(n == 0 || unlink("fillfile") < 0){
+    printf(1, "fillfile failed\n");
+    exit();
+  }
+  n2 = fill();
+  if(n2 != n){
+    printf(1, "second fill wrote %d chunks, first %d\n", n2, n);
+    exit();
+  }
+  if(unlink("fillfile") < 0){
+    printf(1, "unlink fillfile failed\n");
+    exit();
+  }
+
+  printf(1, "disk fill test ok\n");
+}
+
+// many names in one directory, all links to db/f, so that
+// they need only one inode.
+#define NDBNAME 2000
+
+void
+dbmake(void)
 {
   int fd;
 
-  // DIRSIZ is 14.
-  printf(1, "fourteen test\n");
+  if(mkdir("db") < 0){
+    printf(1, "mkdir db failed\n");
+    exit();
+  }
+  fd = open("db/f", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf(1, "cannot create db/f\n");
+    exit();
+  }
+  close(fd);
+}
 
-  if(mkdir("12345678901234") != 0){
-    printf(1, "mkdir 12345678901234 failed\n");
+// Link ('l'), look up ('s') or unlink ('u') the names.
+void
+dbnames(int op)
+{
+  char name[16];
+  struct stat st;
+  int i, r;
+
+  for(i = 0; i < NDBNAME; i++){
+    mkname(name, "db/n", i);
+    if(op == 'l')
+      r = link("db/f", name);
+    else if(op == 's')
+      r = (stat(name, &st) < 0 || st.type != T_FILE) ? -1 : 0;
+    else
+      r = unlink(name);
+    if(r < 0){
+      printf(1, "dbnames: %c %s failed\n", op, name);
+      exit();
+    }
+  }
+}
+
+void
+dbremove(void)
+{
+  if(unlink("db/f") < 0 || unlink("db") < 0){
+    printf(1, "unlink db failed\n");
     exit();
   }
-  if(mkdir("12345678901234/123456789012345") != 0){
-    printf(1, "mkdir 12345678901234/123456789012345 failed\n");
+}
+
+// on a file system built with mkfs -h, the names do not fit
+// in one block, so the directory must have split: its index
+// block lists more than one block.
+void
+hashdirtest(void)
+{
+  struct dxentry dx[2];
+  struct stat st;
+  int fd;
+
+  printf(1, "hashed dir test\n");
+  dbmake();
+  dbnames('l');
+  dbnames('s');
+  fd = open("db", O_RDONLY);
+  if(fd < 0 || fstat(fd, &st) < 0){
+    printf(1, "cannot open db\n");
     exit();
   }
-  fd = open("123456789012345/123456789012345/123456789012345", O_CREATE);
+  if(st.layout & L_HASHED){
+    if(pread(fd, dx, sizeof(dx), DXOFF) != sizeof(dx) ||
+       dx[0].block == 0 || dx[1].block == 0){
+      printf(1, "db has %d names in one block\n", NDBNAME);
+      exit();
+    }
+  }
+  close(fd);
+  dbnames('u');
+  dbremove();
+  printf(1, "hashed dir test ok\n");
+}
+
+// create and delete many files, each of which needs an inode
+// of its own; more in all than the disk has inodes.
+#define NCBFILE  100
+#define CBROUNDS 5
+
+// Create the files, recording their inode numbers.
+void
+cbcreate(uint *ino)
+{
+  char name[16];
+  struct stat st;
+  int fd, i;
+
+  for(i = 0; i < NCBFILE; i++){
+    mkname(name, "cb", i);
+    fd = open(name, O_CREATE | O_RDWR);
+    if(fd < 0 || fstat(fd, &st) < 0){
+      printf(1, "create %s failed\n", name);
+      exit();
+    }
+    ino[i] = st.ino;
+    close(fd);
+  }
+}
+
+void
+cbremove(void)
+{
+  char name[16];
+  int i;
+
+  for(i = 0; i < NCBFILE; i++){
+    mkname(name, "cb", i);
+    if(unlink(name) < 0){
+      printf(1, "unlink %s failed\n", name);
+      exit();
+    }
+  }
+}
+
+// every live file must have an inode of its own, and since
+// ialloc starts from a rotor, a round must not get the same
+// inode numbers as the round before.
+void
+inodetest(void)
+{
+  uint ino[NCBFILE], first;
+  int i, j, r;
+
+  printf(1, "inode test\n");
+  first = 0;
+  for(r = 0; r < CBROUNDS; r++){
+    cbcreate(ino);
+    for(i = 0; i < NCBFILE; i++){
+      for(j = 0; j < i; j++){
+        if(ino[i] == ino[j]){
+          printf(1, "inode %d given to two files\n", ino[i]);
+          exit();
+        }
+      }
+    }
+    if(ino[0] == first){
+      printf(1, "round %d reused inode %d first\n", r, first);
+      exit();
+    }
+    first = ino[0];
+    cbremove();
+  }
+  printf(1, "inode test ok\n");
+}
+
+// many small files, of the size that fits in an inode
+// when the file system is made with mkfs -i.
+#define NSMALL  100
+#define SMSIZE  40
+
+// Write ('w'), read back ('r') or unlink ('u') the files.
+void
+smallfiles(int op)
+{
+  char name[16], data[SMSIZE];
+  int fd, i;
+
+  for(i = 0; i < NSMALL; i++){
+    mkname(name, "sf", i);
+    if(op == 'u'){
+      unlink(name);
+      continue;
+    }
+    if(op == 'w'){
+      memset(data, 'a' + i % 26, SMSIZE);
+      fd = open(name, O_CREATE | O_RDWR);
+      if(fd < 0 || write(fd, data, SMSIZE) != SMSIZE){
+        printf(1, "create %s failed\n", name);
+        exit();
+      }
+    } else {
+      fd = open(name, 0);
+      if(fd < 0 || read(fd, data, SMSIZE) != SMSIZE ||
+         data[0] != 'a' + i % 26 || data[SMSIZE-1] != data[0]){
+        printf(1, "read %s failed\n", name);
+        exit();
+      }
+    }
+    close(fd);
+  }
+}
+
+// a file with inline data has no data blocks, so it must
+// stay inline up to NINLINE bytes, and move to blocks,
+// keeping its data, when written past that.
+void
+inlinetest(void)
+{
+  struct stat st;
+  int fd, i;
+
+  printf(1, "inline test\n");
+  smallfiles('w');
+  smallfiles('r');
+  fd = open("sf0000", O_RDWR);
+  if(fd < 0 || fstat(fd, &st) < 0){
+    printf(1, "cannot open sf0000\n");
+    exit();
+  }
+  if(st.layout & L_INLINE){
+    memset(buf, 'i', NINLINE+1);
+    if(pwrite(fd, buf, NINLINE, 0) != NINLINE || fstat(fd, &st) < 0 ||
+       st.size != NINLINE || !(st.layout & L_INLINE)){
+      printf(1, "file of %d bytes is not inline\n", NINLINE);
+      exit();
+    }
+    if(pwrite(fd, buf, 1, NINLINE) != 1 || fstat(fd, &st) < 0 ||
+       st.size != NINLINE+1 || (st.layout & L_INLINE)){
+      printf(1, "file of %d bytes is inline\n", NINLINE+1);
+      exit();
+    }
+    memset(buf, 0, NINLINE+1);
+    if(pread(fd, buf, NINLINE+2, 0) != NINLINE+1){
+      printf(1, "read of uninlined file failed\n");
+      exit();
+    }
+    for(i = 0; i <= NINLINE; i++){
+      if(buf[i] != 'i'){
+        printf(1, "uninlined file lost byte %d\n", i);
+        exit();
+      }
+    }
+  }
+  close(fd);
+  smallfiles('u');
+  printf(1, "inline test ok\n");
+}
+
+// readv, writev, pread and pwrite.
+void
+iovtest(void)
+{
+  struct iovec iov[3];
+  char a[4], b[8];
+  int fd;
+
+  printf(1, "iov test\n");
+
+  fd = open("iovfile", O_CREATE | O_RDWR);
   if(fd < 0){
-    printf(1, "create 123456789012345/123456789012345/123456789012345 failed\n");
+    printf(1, "create iovfile failed\n");
+    exit();
+  }
+  iov[0].base = "abc";
+  iov[0].len = 3;
+  iov[1].base = "";
+  iov[1].len = 0;
+  iov[2].base = "defghij";
+  iov[2].len = 7;
+  if(writev(fd, iov, 3) != 10){
+    printf(1, "writev failed\n");
+    exit();
+  }
+  if(pwrite(fd, "XY", 2, 4) != 2 || pread(fd, b, 3, 3) != 3 ||
+     b[0] != 'd' || b[1] != 'X' || b[2] != 'Y'){
+    printf(1, "pread/pwrite failed\n");
+    exit();
+  }
+  // pwrite and pread leave the offset at 10.
+  if(write(fd, "k", 1) != 1 || pread(fd, b, 8, 8) != 3 || b[2] != 'k'){
+    printf(1, "pwrite moved the offset\n");
+    exit();
+  }
+  if(pread(fd, b, 1, -1) >= 0 || pread(fd, b, 1, 100) > 0){
+    printf(1, "pread bad offset\n");
     exit();
   }
   close(fd);
-  fd = open("12345678901234/12345678901234/12345678901234", 0);
+
+  fd = open("iovfile", O_RDONLY);
+  iov[0].base = a;
+  iov[0].len = 4;
+  iov[1].base = b;
+  iov[1].len = 8;
+  if(readv(fd, iov, 2) != 11 || a[3] != 'd' || b[1] != 'Y' || b[6] != 'k'){
+    printf(1, "readv failed\n");
+    exit();
+  }
+  if(readv(fd, iov, 2) != 0){
+    printf(1, "readv at end failed\n");
+    exit();
+  }
+  close(fd);
+  unlink("iovfile");
+
+  printf(1, "iov test ok\n");
+}
+
+// printf to a file, through the buffered output in printf.c,
+// should take far fewer write() calls than printf calls.
+#define NRECORD 1000
+
+void
+stdiotest(void)
+{
+  char line[32];
+  struct stat st;
+  int fd, i, w;
+
+  printf(1, "stdio test\n");
+  fd = open("stdiofile", O_CREATE | O_RDWR);
   if(fd < 0){
-    printf(1, "open 12345678901234/12345678901234/12345678901234 failed\n");
+    printf(1, "create stdiofile failed\n");
     exit();
   }
+  w = outwrites;
+  for(i = 0; i < NRECORD; i++){
+    printf(fd, "record %d", i);
+    printf(fd, " of %d\n", NRECORD);
+  }
   close(fd);
+  w = outwrites - w;
+  if(stat("stdiofile", &st) < 0 || w == 0 || w > st.size/256 + 1){
+    printf(1, "%d printf calls made %d write calls\n", 2*NRECORD, w);
+    exit();
+  }
 
-  if(mkdir("12345678901234/12345678901234") == 0){
-    printf(1, "mkdir 12345678901234/12345678901234 succeeded!\n");
+  fd = open("stdiofile", O_RDONLY);
+  if(fd < 0 || read(fd, line, 17) != 17){
+    printf(1, "read stdiofile failed\n");
     exit();
   }
-  if(mkdir("123456789012345/12345678901234") == 0){
-    printf(1, "mkdir 12345678901234/123456789012345 succeeded!\n");
+  line[17] = 0;
+  if(strcmp(line, "record 0 of 1000\n") != 0){
+    printf(1, "stdiofile has the wrong contents\n");
     exit();
   }
+  close(fd);
+  unlink("stdiofile");
+  printf(1, "stdio test ok\n");
+}
 
-  printf(1, "fourteen ok\n");
+// sfsrc: SFSIZE bytes, each sizeof(buf) run a letter.
+#define SFSIZE (100*1024)
+
+void
+sfmake(void)
+{
+  int fd, i, n;
+
+  fd = open("sfsrc", O_CREATE | O_RDWR);
+  for(i = 0; i < SFSIZE; i += n){
+    n = sizeof(buf);
+    memset(buf, 'a' + i / sizeof(buf) % 26, n);
+    if(write(fd, buf, n) != n){
+      printf(1, "write sfsrc failed\n");
+      exit();
+    }
+  }
+  close(fd);
+}
+
+// sendfile from a file to a file and to a pipe,
+// checking the copies.
+void
+sendfiletest(void)
+{
+  int fd, out, i, n, tot, pid, fds[2];
+
+  printf(1, "sendfile test\n");
+  sfmake();
+
+  fd = open("sfsrc", O_RDONLY);
+  out = open("sfdst", O_CREATE | O_RDWR);
+  tot = 0;
+  while((n = sendfile(out, fd, 1<<20)) > 0)
+    tot += n;
+  if(n < 0 || tot != SFSIZE || sendfile(out, fd, 10) != 0 || sendfile(fd, out, 10) >= 0){
+    printf(1, "sendfile to file failed\n");
+    exit();
+  }
+  close(out);
+  close(fd);
+  fd = open("sfdst", O_RDONLY);
+  for(i = 0; i < SFSIZE; i += n){
+    if((n = read(fd, buf, sizeof(buf))) != sizeof(buf) ||
+       buf[0] != 'a' + i / sizeof(buf) % 26 || buf[n-1] != buf[0]){
+      printf(1, "sfdst has the wrong contents\n");
+      exit();
+    }
+  }
+  close(fd);
+  unlink("sfdst");
+
+  if(pipe(fds) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid == 0){
+    close(fds[0]);
+    fd = open("sfsrc", O_RDONLY);
+    if(sendfile(fds[1], fd, SFSIZE) != SFSIZE){
+      printf(1, "sendfile to pipe failed\n");
+      exit();
+    }
+    exit();
+  }
+  close(fds[1]);
+  tot = 0;
+  while((n = read(fds[0], buf, sizeof(buf))) > 0){
+    for(i = 0; i < n; i++){
+      if(buf[i] != 'a' + (tot + i) / sizeof(buf) % 26){
+        printf(1, "sendfile pipe has the wrong contents\n");
+        exit();
+      }
+    }
+    tot += n;
+  }
+  close(fds[0]);
+  wait();
+  if(tot != SFSIZE){
+    printf(1, "sendfile pipe got %d bytes\n", tot);
+    exit();
+  }
+  unlink("sfsrc");
+  printf(1, "sendfile test ok\n");
+}
+
+// names up to DIRSIZ (255) bytes, kept whole.
+void
+longname(void)
+{
+  char *dir, *path;
+  int fd;
+
+  printf(1, "longname test\n");
+
+  if(mkdir("12345678901234567890") != 0){
+    printf(1, "mkdir 12345678901234567890 failed\n");
+    exit();
+  }
+  if(chdir("12345678901234") == 0){
+    printf(1, "chdir 12345678901234 succeeded!\n");
+    exit();
+  }
+
+  // buf holds a DIRSIZ-byte directory name, a slash, and
+  // a DIRSIZ-byte file name; dir is a copy of the first.
+  dir = buf + 1024;
+  memset(buf, 'x', DIRSIZ);
+  buf[DIRSIZ] = 0;
+  strcpy(dir, buf);
+  if(mkdir(dir) != 0){
+    printf(1, "mkdir 255-byte name failed\n");
+    exit();
+  }
+  path = buf + DIRSIZ;
+  *path++ = '/';
+  memset(path, 'y', DIRSIZ);
+  path[DIRSIZ] = 0;
+  fd = open(buf, O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(1, "create 255-byte name failed\n");
+    exit();
+  }
+  close(fd);
+  if(chdir(dir) != 0 || (fd = open(path, 0)) < 0){
+    printf(1, "open 255-byte name failed\n");
+    exit();
+  }
+  close(fd);
+  if(unlink(path) != 0 || chdir("..") != 0){
+    printf(1, "unlink 255-byte name failed\n");
+    exit();
+  }
+
+  // One byte longer is too long.
+  path[DIRSIZ] = 'y';
+  path[DIRSIZ+1] = 0;
+  if(open(buf, O_CREATE|O_RDWR) >= 0){
+    printf(1, "create 256-byte name succeeded!\n");
+    exit();
+  }
+
+  if(unlink(dir) != 0 || unlink("12345678901234567890") != 0){
+    printf(1, "unlink longname dirs failed\n");
+    exit();
+  }
+  printf(1, "longname ok\n");
 }
 
 void
@@ -1191,6 +1892,96 @@ iref(void)
   printf(1, "empty file name OK\n");
 }
 
+// several processes stat() and open() the same deep path at
+// once, every component an inode cache hit, and check that
+// the results stay right.
+#define PBPROCS 4
+#define PBITERS 200
+
+char *pbdirs[] = { "pb", "pb/a", "pb/a/b", "pb/a/b/c", "pb/a/b/c/d",
+                   "pb/a/b/c/d/e", "pb/a/b/c/d/e/f", "pb/a/b/c/d/e/f/g" };
+#define NPBDIR (sizeof(pbdirs) / sizeof(pbdirs[0]))
+char *pbfile = "pb/a/b/c/d/e/f/g/x";
+
+void
+pbmake(void)
+{
+  int i, fd;
+
+  for(i = 0; i < NPBDIR; i++){
+    if(mkdir(pbdirs[i]) < 0){
+      printf(1, "pbmake: mkdir %s failed\n", pbdirs[i]);
+      exit();
+    }
+  }
+  fd = open(pbfile, O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, "x", 1) != 1){
+    printf(1, "pbmake: create failed\n");
+    exit();
+  }
+  close(fd);
+}
+
+void
+pbremove(void)
+{
+  int n;
+
+  if(unlink(pbfile) < 0){
+    printf(1, "pbremove: unlink %s failed\n", pbfile);
+    exit();
+  }
+  for(n = NPBDIR - 1; n >= 0; n--){
+    if(unlink(pbdirs[n]) < 0){
+      printf(1, "pbremove: unlink %s failed\n", pbdirs[n]);
+      exit();
+    }
+  }
+}
+
+// Run the lookups in PBPROCS processes and wait for them.
+void
+pbrun(void)
+{
+  struct stat st;
+  int i, n, fd, pid;
+
+  for(n = 0; n < PBPROCS; n++){
+    pid = fork();
+    if(pid < 0){
+      printf(1, "pbrun: fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      for(i = 0; i < PBITERS; i++){
+        if(stat(pbfile, &st) < 0 || st.type != T_FILE || st.size != 1){
+          printf(1, "pbrun: stat failed\n");
+          exit();
+        }
+        fd = open(pbfile, O_RDONLY);
+        if(fd < 0){
+          printf(1, "pbrun: open failed\n");
+          exit();
+        }
+        close(fd);
+      }
+      exit();
+    }
+  }
+  for(n = 0; n < PBPROCS; n++)
+    wait();
+}
+
+void
+pathtest(void)
+{
+  printf(1, "path lookup test\n");
+  pbmake();
+  pbrun();
+  pbremove();
+  printf(1, "path lookup test ok\n");
+}
+
 // test that fork fails gracefully
 // the forktest binary also does this, but it runs out of proc entries first.
 // inside the bigger usertests binary, we run out of memory first.
@@ -1229,9 +2020,334 @@ forktest(void)
   printf(1, "fork test OK\n");
 }
 
+// Benchmarks, run by "usertests bench" instead of the tests.
+// Each prints how long its timed parts took.
+
+void
+ticks(char *what, int t0)
+{
+  printf(1, "%s: %d ticks\n", what, uptime() - t0);
+}
+
+// stream every file in the root directory through a small
+// buffer, as cat and wc would.  run first, so that most of the
+// files are not cached yet and read-ahead has work to do.
+void
+streambench(void)
+{
+  struct dirent de;
+  struct stat st;
+  int dfd, fd, n, t0;
+
+  dfd = open(".", O_RDONLY);
+  if(dfd < 0){
+    printf(1, "streambench: cannot open .\n");
+    exit();
+  }
+  t0 = uptime();
+  while(readdir(dfd, &de)){
+    if((fd = open(de.name, O_RDONLY)) < 0)
+      continue;
+    if(fstat(fd, &st) < 0 || st.type != T_FILE){
+      close(fd);
+      continue;
+    }
+    while((n = read(fd, buf, 128)) > 0)
+      ;
+    if(n < 0){
+      printf(1, "streambench: read %s failed\n", de.name);
+      exit();
+    }
+    close(fd);
+  }
+  close(dfd);
+  ticks("stream every file in /", t0);
+}
+
+// read a large file once to warm the buffer cache, then
+// re-read it.  with a cache big enough to hold the file the
+// re-reads should not touch the disk.
+#define RRKB     64
+#define RRPASSES 20
+
+void
+rrpass(void)
+{
+  int fd, i;
+
+  fd = open("rrfile", 0);
+  if(fd < 0){
+    printf(1, "cannot open rrfile\n");
+    exit();
+  }
+  for(i = 0; i < RRKB; i++){
+    if(read(fd, buf, 1024) != 1024 || buf[0] != (char)i || buf[1023] != (char)i){
+      printf(1, "read rrfile failed\n");
+      exit();
+    }
+  }
+  close(fd);
+}
+
+void
+rereadbench(void)
+{
+  int fd, i, t0;
+
+  fd = open("rrfile", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf(1, "cannot create rrfile\n");
+    exit();
+  }
+  for(i = 0; i < RRKB; i++){
+    memset(buf, i, 1024);
+    if(write(fd, buf, 1024) != 1024){
+      printf(1, "write rrfile failed\n");
+      exit();
+    }
+  }
+  close(fd);
+
+  t0 = uptime();
+  rrpass();
+  ticks("first read of 64 KB", t0);
+  t0 = uptime();
+  for(i = 0; i < RRPASSES; i++)
+    rrpass();
+  ticks("20 re-reads of 64 KB", t0);
+  unlink("rrfile");
+}
+
+// write a file and fsync it: the flusher queues its blocks in
+// sector order and the disk driver merges them into
+// multi-sector commands.  ^T on the console shows the counts.
+#define SEQKB 64
+
+void
+seqwritebench(void)
+{
+  int fd, i, t0;
+
+  fd = open("seqfile", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf(1, "cannot create seqfile\n");
+    exit();
+  }
+  t0 = uptime();
+  for(i = 0; i < SEQKB; i++){
+    memset(buf, i, 1024);
+    if(write(fd, buf, 1024) != 1024){
+      printf(1, "write seqfile failed\n");
+      exit();
+    }
+  }
+  if(fsync(fd) != 0){
+    printf(1, "fsync seqfile failed\n");
+    exit();
+  }
+  close(fd);
+  ticks("write and sync 64 KB", t0);
+  unlink("seqfile");
+}
+
+// fill the disk, then unlink the file.  allocation should
+// not slow down as the disk fills.
+void
+fillbench(void)
+{
+  int t0;
+
+  t0 = uptime();
+  fill();
+  ticks("fill the disk", t0);
+  t0 = uptime();
+  if(unlink("fillfile") < 0){
+    printf(1, "unlink fillfile failed\n");
+    exit();
+  }
+  ticks("unlink the full disk's file", t0);
+}
+
+void
+dirbench(void)
+{
+  int t0;
+
+  dbmake();
+  t0 = uptime();
+  dbnames('l');
+  ticks("link 2000 names in a directory", t0);
+  t0 = uptime();
+  dbnames('s');
+  ticks("look them up", t0);
+  t0 = uptime();
+  dbnames('u');
+  ticks("unlink them", t0);
+  dbremove();
+}
+
+void
+createbench(void)
+{
+  uint ino[NCBFILE];
+  int r, t0;
+
+  t0 = uptime();
+  for(r = 0; r < CBROUNDS; r++){
+    cbcreate(ino);
+    cbremove();
+  }
+  ticks("create and delete 500 files", t0);
+}
+
+#define SMROUNDS 10
+
+void
+smallfilebench(void)
+{
+  int r, t0;
+
+  t0 = uptime();
+  smallfiles('w');
+  ticks("write 100 small files", t0);
+  t0 = uptime();
+  for(r = 0; r < SMROUNDS; r++)
+    smallfiles('r');
+  ticks("read them 10 times", t0);
+  smallfiles('u');
+}
+
+// records of three fragments written with a write() per
+// fragment and with one writev() per record.
+void
+iovbench(void)
+{
+  struct iovec iov[3];
+  int fd, i, t0;
+
+  fd = open("iovfile", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf(1, "create iovfile failed\n");
+    exit();
+  }
+  t0 = uptime();
+  for(i = 0; i < NRECORD; i++){
+    write(fd, "key=", 4);
+    write(fd, "value", 5);
+    write(fd, "\n", 1);
+  }
+  ticks("1000 records by write", t0);
+  iov[0].base = "key=";
+  iov[0].len = 4;
+  iov[1].base = "value";
+  iov[1].len = 5;
+  iov[2].base = "\n";
+  iov[2].len = 1;
+  t0 = uptime();
+  for(i = 0; i < NRECORD; i++){
+    if(writev(fd, iov, 3) != 10){
+      printf(1, "writev record failed\n");
+      exit();
+    }
+  }
+  ticks("1000 records by writev", t0);
+  close(fd);
+  unlink("iovfile");
+}
+
+// copy sfsrc with read() and write() through buf,
+// and with sendfile.
+void
+sendfilebench(void)
+{
+  int fd, out, n, t0;
+
+  sfmake();
+  fd = open("sfsrc", O_RDONLY);
+  out = open("sfdst", O_CREATE | O_RDWR);
+  t0 = uptime();
+  while((n = read(fd, buf, sizeof(buf))) > 0)
+    write(out, buf, n);
+  ticks("copy 100 KB by read and write", t0);
+  close(out);
+  close(fd);
+  unlink("sfdst");
+
+  fd = open("sfsrc", O_RDONLY);
+  out = open("sfdst", O_CREATE | O_RDWR);
+  t0 = uptime();
+  while(sendfile(out, fd, 1<<20) > 0)
+    ;
+  ticks("copy 100 KB by sendfile", t0);
+  close(out);
+  close(fd);
+  unlink("sfdst");
+  unlink("sfsrc");
+}
+
+void
+pathbench(void)
+{
+  int t0;
+
+  pbmake();
+  t0 = uptime();
+  pbrun();
+  ticks("4 processes x 200 stat+open of a 9-deep path", t0);
+  pbremove();
+}
+
+void
+unlinkbench(void)
+{
+  int fd, i, t0;
+
+  fd = open("ulfile", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf(1, "cannot create ulfile\n");
+    exit();
+  }
+  memset(buf, 'u', 1024);
+  for(i = 0; i < 4*1024; i++){
+    if(write(fd, buf, 1024) != 1024){
+      printf(1, "write ulfile failed\n");
+      exit();
+    }
+  }
+  if(fsync(fd) != 0){
+    printf(1, "fsync ulfile failed\n");
+    exit();
+  }
+  close(fd);
+
+  t0 = uptime();
+  if(unlink("ulfile") < 0){
+    printf(1, "unlink ulfile failed\n");
+    exit();
+  }
+  ticks("unlink a 4 MB file", t0);
+}
+
 int
 main(int argc, char *argv[])
 {
+  if(argc > 1 && strcmp(argv[1], "bench") == 0){
+    printf(1, "benchmarks starting\n");
+    streambench();
+    rereadbench();
+    seqwritebench();
+    fillbench();
+    unlinkbench();
+    dirbench();
+    createbench();
+    smallfilebench();
+    iovbench();
+    sendfilebench();
+    pathbench();
+    printf(1, "benchmarks done\n");
+    exit();
+  }
+
   printf(1, "usertests starting\n");
 
   if(open("usertests.ran", 0) >= 0){
@@ -1251,8 +2367,19 @@ main(int argc, char *argv[])
   exitwait();
 
   rmdot();
-  fourteen();
+  longname();
   bigfile();
+  extentlimit();
+  extenttest();
+  appendtest();
+  hugefile();
+  filltest();
+  hashdirtest();
+  inodetest();
+  inlinetest();
+  iovtest();
+  stdiotest();
+  sendfiletest();
   subdir();
   concreate();
   linktest();
@@ -1262,6 +2389,7 @@ main(int argc, char *argv[])
   sharedfd();
   dirfile();
   iref();
+  pathtest();
   forktest();
   bigdir(); // slow
 
@@ -9,6 +9,15 @@ inb(ushort port)
   return data;
 }
 
+static inline uint
+inl(ushort port)
+{
+  uint data;
+
+  asm volatile("in %1,%0" : "=a" (data) : "d" (port));
+  return data;
+}
+
 static inline void
 insl(int port, void *addr, int cnt)
 {
@@ -30,6 +39,12 @@ outw(ushort port, ushort data)
   asm volatile("out %0,%1" : : "a" (data), "d" (port));
 }
 
+static inline void
+outl(ushort port, uint data)
+{
+  asm volatile("out %0,%1" : : "a" (data), "d" (port));
+}
+
 static inline void
 outsl(int port, const void *addr, int cnt)
 {
@@ -103,6 +118,62 @@ xchg(volatile uint *addr, uint newval)
   return result;
 }
 
+// Atomically add incr to *addr and return the old value.
+static inline uint
+xaddl(volatile uint *addr, uint incr)
+{
+  uint result;
+
+  asm volatile("lock; xaddl %0, %1" :
+               "=r" (result), "+m" (*addr) :
+               "0" (incr) :
+               "cc");
+  return result;
+}
+
+// Atomically replace *addr with newval if it equals old.
+// Returns the value *addr held before; the swap happened
+// if that equals old.
+static inline uint
+cmpxchg(volatile uint *addr, uint old, uint newval)
+{
+  uint result;
+
+  asm volatile("lock; cmpxchgl %2, %1" :
+               "=a" (result), "+m" (*addr) :
+               "r" (newval), "0" (old) :
+               "cc", "memory");
+  return result;
+}
+
+// Index of the lowest set bit in x, which must not be 0.
+static inline uint
+bsf(uint x)
+{
+  uint r;
+
+  asm("bsfl %1,%0" : "=r" (r) : "rm" (x) : "cc");
+  return r;
+}
+
+// Read the time-stamp counter (CPU cycles since reset).
+static inline uint64
+rdtsc(void)
+{
+  uint64 t;
+
+  asm volatile("rdtsc" : "=A" (t));
+  return t;
+}
+
+// Spin-wait hint: saves power and avoids a memory-order
+// pipeline flush when the awaited value finally changes.
+static inline void
+pause(void)
+{
+  asm volatile("pause");
+}
+
 static inline void
 loadgs(ushort v)
 {